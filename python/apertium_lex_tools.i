@@ -1,6 +1,8 @@
 %module apertium_lex_tools
 
+%include <std_string.i>
 %include <lrx_processor.h>
+%include <lrx_session.h>
 %include <lttoolbox/lt_locale.h>
 
 %typemap(in) (int argc, char **argv) {
@@ -33,13 +35,17 @@
 %inline%{
 #define SWIG_FILE_WITH_INIT
 #include <lrx_processor.h>
+#include <lrx_session.h>
 #include <lttoolbox/lt_locale.h>
 #include <unicode/ustdio.h>
 
 #include <getopt.h>
 
-class LRXProc: public LRXProcessor
+class LRXProc
 {
+private:
+  unique_ptr<LRXModel> model;
+
 public:
   /**
    * Imitates functionality of lrx_proc using file path
@@ -47,15 +53,16 @@ public:
   LRXProc(char *dictionary_path)
   {
     FILE *dictionary = fopen(dictionary_path, "rb");
-    load(dictionary);
+    model.reset(new LRXModel(dictionary));
     fclose(dictionary);
   }
 
   void lrx_proc(int argc, char **argv, char *input_path, char *output_path)
   {
-	InputFile input;
-	input.open(input_path);
-	UFILE* output = u_fopen(output_path, "w", NULL, NULL);
+    LRXSession session(*model);
+    InputFile input;
+    input.open(input_path);
+    UFILE* output = u_fopen(output_path, "w", NULL, NULL);
     optind = 1;
     while(true)
     {
@@ -71,23 +78,52 @@ public:
           break;
 
         case 'z':
-          setNullFlush(true);
+          session.setNullFlush(true);
           break;
 
         case 't':
-          setTraceMode(true);
+          session.setTraceMode(true);
           break;
 
         case 'd':
-          setDebugMode(true);
+          session.setDebugMode(true);
           break;
         default:
           break;
       }
     }
-    process(input, output);
+    session.process(input, output);
     u_fclose(output);
   }
 };
 
 %}
+
+%extend LRXModel {
+  /**
+   * Loads the rules from a file path, to be shared by any number of
+   * sessions
+   */
+  LRXModel(char *dictionary_path)
+  {
+    FILE *dictionary = fopen(dictionary_path, "rb");
+    LRXModel *model = new LRXModel(dictionary);
+    fclose(dictionary);
+    return model;
+  }
+}
+
+%extend LRXSession {
+  /**
+   * Imitates functionality of lrx_proc using file paths, as the next part
+   * of the session's stream
+   */
+  void lrx_proc(char *input_path, char *output_path)
+  {
+    InputFile input;
+    input.open(input_path);
+    UFILE* output = u_fopen(output_path, "w", NULL, NULL);
+    $self->process(input, output);
+    u_fclose(output);
+  }
+}
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_affixes.h>
+
+#include <algorithm>
+#include <map>
+
+#include <lttoolbox/string_utils.h>
+
+using namespace std;
+
+static UString const LRX_AFFIXES_SUFFIX = "<SUFFIX:"_u;
+static UString const LRX_AFFIXES_CONTAINS = "<CONTAINS:"_u;
+
+int32_t
+LRXAffixes::Trie::step(int32_t node, int32_t label) const
+{
+  auto begin = labels.begin() + offsets[node];
+  auto end = labels.begin() + offsets[node+1];
+  auto it = lower_bound(begin, end, label);
+  if(it == end || *it != label)
+  {
+    return -1;
+  }
+  return targets[it - labels.begin()];
+}
+
+void
+LRXAffixes::Trie::build(bool reversed)
+{
+  vector<map<int32_t, int32_t>> edges(1);
+  ends.assign(1, -1);
+  for(size_t i = 0; i < literals.size(); i++)
+  {
+    UString literal = literals[i];
+    if(reversed)
+    {
+      reverse(literal.begin(), literal.end());
+    }
+    int32_t node = 0;
+    for(auto& c : literal)
+    {
+      auto it = edges[node].find(c);
+      if(it == edges[node].end())
+      {
+        it = edges[node].insert(make_pair(static_cast<int32_t>(c), static_cast<int32_t>(edges.size()))).first;
+        edges.emplace_back();
+        ends.push_back(-1);
+      }
+      node = it->second;
+    }
+    if(ends[node] < 0)
+    {
+      ends[node] = i;
+    }
+  }
+
+  offsets.assign(1, 0);
+  labels.clear();
+  targets.clear();
+  for(auto& e : edges)
+  {
+    for(auto& it : e)
+    {
+      labels.push_back(it.first);
+      targets.push_back(it.second);
+    }
+    offsets.push_back(labels.size());
+  }
+}
+
+void
+LRXAffixes::Trie::links()
+{
+  fail.assign(ends.size(), 0);
+  dict.assign(ends.size(), -1);
+  vector<int32_t> todo(1, 0);
+  for(size_t i = 0; i < todo.size(); i++)
+  {
+    int32_t node = todo[i];
+    for(uint32_t e = offsets[node]; e < offsets[node+1]; e++)
+    {
+      int32_t target = targets[e];
+      if(node != 0)
+      {
+        int32_t f = fail[node];
+        while(f != 0 && step(f, labels[e]) < 0)
+        {
+          f = fail[f];
+        }
+        int32_t g = step(f, labels[e]);
+        fail[target] = (g >= 0 ? g : 0);
+      }
+      dict[target] = (ends[fail[target]] >= 0 ? fail[target] : dict[fail[target]]);
+      todo.push_back(target);
+    }
+  }
+}
+
+int32_t
+LRXAffixes::add(Kind kind, UString const &literal, Alphabet &alphabet)
+{
+  Trie &trie = (kind == Suffix ? suffixes : contains);
+  size_t id = find(trie.literals.begin(), trie.literals.end(), literal) - trie.literals.begin();
+  if(id == trie.literals.size())
+  {
+    UString name = (kind == Suffix ? LRX_AFFIXES_SUFFIX : LRX_AFFIXES_CONTAINS);
+    name += StringUtils::itoa(id) + ">"_u;
+    if(!alphabet.isSymbolDefined(name))
+    {
+      alphabet.includeSymbol(name);
+    }
+    trie.literals.push_back(literal);
+    trie.symbols.push_back(alphabet(name));
+  }
+  return trie.symbols[id];
+}
+
+bool
+LRXAffixes::empty() const
+{
+  return suffixes.literals.empty() && contains.literals.empty();
+}
+
+void
+LRXAffixes::write(LRXFlatWriter &output) const
+{
+  output.strings(suffixes.literals);
+  output.array(suffixes.symbols);
+  output.strings(contains.literals);
+  output.array(contains.symbols);
+}
+
+void
+LRXAffixes::read(LRXFlatReader &input)
+{
+  for(auto trie : {&suffixes, &contains})
+  {
+    trie->literals = input.strings();
+    auto symbols = input.array<int32_t>();
+    trie->symbols.assign(symbols.begin(), symbols.end());
+    if(trie->symbols.size() != trie->literals.size())
+    {
+      cerr << "Error: Invalid rules binary (bad affixes)." << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  suffixes.build(true);
+  contains.build(false);
+  contains.links();
+}
+
+void
+LRXAffixes::step(const vector<int32_t> &from, int32_t sym,
+                 LRXAlternatives const &alternatives,
+                 vector<int32_t> &to, Trie const &trie, bool follow)
+{
+  int32_t alts[LRXAlternatives::MAX];
+  size_t n = alternatives.get(sym, alts);
+  to.clear();
+  for(auto& node : from)
+  {
+    for(size_t i = 0; i < n; i++)
+    {
+      if(alts[i] <= 0)
+      {
+        continue;
+      }
+      int32_t t = node;
+      while(follow && t != 0 && trie.step(t, alts[i]) < 0)
+      {
+        t = trie.fail[t];
+      }
+      int32_t target = trie.step(t, alts[i]);
+      if(target >= 0)
+      {
+        to.push_back(target);
+      }
+      else if(follow)
+      {
+        to.push_back(0);
+      }
+    }
+  }
+  sort(to.begin(), to.end());
+  to.erase(unique(to.begin(), to.end()), to.end());
+}
+
+void
+LRXAffixes::match(const int32_t *chars, size_t count, LRXAlternatives const &alternatives,
+                  vector<int32_t> &result) const
+{
+  result.clear();
+  vector<int32_t> cur;
+  vector<int32_t> next;
+
+  if(!suffixes.literals.empty())
+  {
+    cur.assign(1, 0);
+    for(size_t i = count; i > 0 && !cur.empty(); i--)
+    {
+      step(cur, chars[i-1], alternatives, next, suffixes, false);
+      for(auto& node : next)
+      {
+        if(suffixes.ends[node] >= 0)
+        {
+          result.push_back(suffixes.symbols[suffixes.ends[node]]);
+        }
+      }
+      cur.swap(next);
+    }
+  }
+
+  if(!contains.literals.empty())
+  {
+    cur.assign(1, 0);
+    for(size_t i = 0; i < count; i++)
+    {
+      step(cur, chars[i], alternatives, next, contains, true);
+      for(auto node : next)
+      {
+        if(contains.ends[node] < 0)
+        {
+          node = contains.dict[node];
+        }
+        for(; node >= 0; node = contains.dict[node])
+        {
+          result.push_back(contains.symbols[contains.ends[node]]);
+        }
+      }
+      cur.swap(next);
+    }
+  }
+
+  sort(result.begin(), result.end());
+  result.erase(unique(result.begin(), result.end()), result.end());
+}
+
+bool
+LRXAffixes::isSymbol(UString const &symbol)
+{
+  return symbol.compare(0, LRX_AFFIXES_SUFFIX.size(), LRX_AFFIXES_SUFFIX) == 0 ||
+         symbol.compare(0, LRX_AFFIXES_CONTAINS.size(), LRX_AFFIXES_CONTAINS) == 0;
+}
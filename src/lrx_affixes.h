@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_AFFIXES_H__
+#define __LRX_AFFIXES_H__
+
+#include <cstdint>
+#include <vector>
+
+#include <lttoolbox/alphabet.h>
+
+#include <lrx_alternatives.h>
+#include <lrx_flat.h>
+
+using namespace std;
+
+/**
+ * The literals of the suffix= and contains= of the <match>es of a rule
+ * file, looked for in the lemma of a word in one pass each, rather than
+ * by <ANY_CHAR> loops in the main transducer that keep a state of every
+ * such rule alive at every character. lrx-comp compiles such a <match>
+ * to a transition on the symbol of its literal followed by a loop on
+ * <ANY_CHAR>, and lrx-proc takes the symbols of the literals found in a
+ * lemma before reading it, so that only the rules whose literal is there
+ * loop over the lemma.
+ *
+ * Suffixes are looked up in a trie of the reversed literals, from the
+ * end of the lemma, and the other literals with Aho-Corasick. A character
+ * of a literal matches a character of the lemma that is the same or has
+ * it as its lower-case form, as a transition on it does.
+ */
+class LRXAffixes
+{
+public:
+  enum Kind { Suffix, Contains };
+
+private:
+  // a trie over the literals of one kind: the edges of node i are
+  // [offsets[i], offsets[i+1]), sorted by label; fail and dict are only
+  // built for Aho-Corasick
+  struct Trie
+  {
+    vector<UString> literals;
+    vector<int32_t> symbols; // of each literal
+    vector<uint32_t> offsets;
+    vector<int32_t> labels;
+    vector<int32_t> targets;
+    vector<int32_t> ends; // the literal ending at each node, or -1
+    vector<int32_t> fail; // the longest proper suffix that is a node
+    vector<int32_t> dict; // the next node on the fail chain ending a literal, or -1
+
+    int32_t step(int32_t node, int32_t label) const;
+    void build(bool reversed);
+    void links();
+  };
+
+  Trie suffixes;
+  Trie contains;
+
+  static void step(const vector<int32_t> &from, int32_t sym,
+                   LRXAlternatives const &alternatives,
+                   vector<int32_t> &to, Trie const &trie, bool follow);
+
+public:
+  /**
+   * The symbol for literal of kind, included in alphabet the first time
+   */
+  int32_t add(Kind kind, UString const &literal, Alphabet &alphabet);
+
+  bool empty() const;
+
+  void write(LRXFlatWriter &output) const;
+  void read(LRXFlatReader &input);
+
+  /**
+   * The symbols of the literals found in the lemma, the characters
+   * chars[0, count), in increasing order
+   */
+  void match(const int32_t *chars, size_t count, LRXAlternatives const &alternatives,
+             vector<int32_t> &result) const;
+
+  /**
+   * Whether symbol is one that add() gives
+   */
+  static bool isSymbol(UString const &symbol);
+};
+
+#endif /* __LRX_AFFIXES_H__ */
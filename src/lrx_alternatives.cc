@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_alternatives.h>
+
+#include <unicode/uchar.h>
+
+using namespace std;
+
+size_t const LRXAlternatives::MAX;
+
+void
+LRXAlternatives::init(int32_t c, int32_t tag, int32_t upper, int32_t low)
+{
+  any_char = c;
+  any_tag = tag;
+  any_upper = upper;
+  any_lower = low;
+
+  lower.assign(0x10000, -1);
+  for(int32_t i = 0; i < 0x10000; i++)
+  {
+    if(u_isupper(i))
+    {
+      lower[i] = u_tolower(i);
+    }
+  }
+}
+
+int32_t
+LRXAlternatives::lowerOf(int32_t sym) const
+{
+  if(sym < static_cast<int32_t>(lower.size()))
+  {
+    return lower[sym];
+  }
+  return u_isupper(sym) ? u_tolower(sym) : -1;
+}
+
+size_t
+LRXAlternatives::get(int32_t sym, int32_t *alts) const
+{
+  size_t n = 0;
+  auto add = [&](int32_t alt) {
+    for(size_t i = 0; i < n; i++)
+    {
+      if(alts[i] == alt)
+      {
+        return;
+      }
+    }
+    alts[n++] = alt;
+  };
+
+  alts[n++] = (sym == 0 ? any_tag : sym);
+  if(sym <= 0)
+  {
+    add(any_tag);
+  }
+  else
+  {
+    add(any_char);
+    int32_t l = lowerOf(sym);
+    if(l >= 0)
+    {
+      add(l);
+      add(any_upper);
+    }
+    else
+    {
+      add(any_lower);
+    }
+  }
+  return n;
+}
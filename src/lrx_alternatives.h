@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_ALTERNATIVES_H__
+#define __LRX_ALTERNATIVES_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+/**
+ * The symbols that an input symbol can take a transition on: the symbol
+ * itself plus ANY_TAG for tags, or ANY_CHAR and ANY_UPPER/ANY_LOWER (and
+ * the lower-case form of an upper-case letter) for characters. The case
+ * of the BMP is looked up once at load time, so getting the alternatives
+ * of a symbol neither allocates nor calls into ICU.
+ */
+class LRXAlternatives
+{
+private:
+  int32_t any_char = 0;
+  int32_t any_tag = 0;
+  int32_t any_upper = 0;
+  int32_t any_lower = 0;
+
+  // lower-case form of each upper-case BMP character, -1 for the rest
+  vector<int32_t> lower;
+
+  int32_t lowerOf(int32_t sym) const;
+
+public:
+  static size_t const MAX = 4;
+
+  void init(int32_t any_char, int32_t any_tag, int32_t any_upper, int32_t any_lower);
+
+  /**
+   * Write the alternatives of the tokenised symbol sym to alts, which
+   * must have room for MAX, and return how many there are. The first is
+   * the input itself (ANY_TAG for a tag missing from the alphabet) and
+   * there are no repeats.
+   */
+  size_t get(int32_t sym, int32_t *alts) const;
+};
+
+#endif /* __LRX_ALTERNATIVES_H__ */
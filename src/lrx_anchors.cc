@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_anchors.h>
+#include <lrx_affixes.h>
+#include <lrx_matcher.h>
+
+#include <unicode/uchar.h>
+#include <unicode/utf16.h>
+
+using namespace std;
+
+size_t const LRXAnchors::LRX_ANCHORS_MAX_ITEMS = 1 << 16;
+
+static void
+appendLower(UString &s, int32_t c)
+{
+  c = u_tolower(c);
+  if(U_IS_BMP(c))
+  {
+    s += static_cast<UChar>(c);
+  }
+  else
+  {
+    s += U16_LEAD(c);
+    s += U16_TRAIL(c);
+  }
+}
+
+// the counter ops of a counted <repeat> are epsilons as far as the words
+// are concerned
+static bool
+isCounter(Alphabet &alphabet, int32_t symbol)
+{
+  if(symbol >= 0)
+  {
+    return false;
+  }
+  UString name;
+  alphabet.getSymbol(name, symbol);
+  return LRXMatcher::counterGuard(name) != 0;
+}
+
+// a suffix= or contains= literal is taken at the end of a wildcard lemma
+static bool
+isAffix(Alphabet &alphabet, int32_t symbol)
+{
+  if(symbol >= 0)
+  {
+    return false;
+  }
+  UString name;
+  alphabet.getSymbol(name, symbol);
+  return LRXAffixes::isSymbol(name);
+}
+
+void
+LRXAnchors::build(Transducer &t, Alphabet &alphabet)
+{
+  int32_t any_char      = alphabet("<ANY_CHAR>"_u);
+  int32_t any_tag       = alphabet("<ANY_TAG>"_u);
+  int32_t any_upper     = alphabet("<ANY_UPPER>"_u);
+  int32_t any_lower     = alphabet("<ANY_LOWER>"_u);
+  int32_t word_boundary = alphabet("<$>"_u);
+  int32_t null_boundary = alphabet("<$$>"_u);
+
+  wildcard = false;
+  lemmas.clear();
+  tags.clear();
+
+  // walk the first word of every rule, keeping the literal lemma read so
+  // far, or noting that the lemma is a wildcard
+  struct Item
+  {
+    int32_t state;
+    bool any;
+    UString lemma;
+  };
+  vector<Item> todo;
+  set<pair<pair<int32_t, bool>, UString>> seen;
+  auto push = [&](int32_t state, bool any, UString const &lemma) {
+    if(seen.insert(make_pair(make_pair(state, any), lemma)).second)
+    {
+      todo.push_back({state, any, lemma});
+    }
+  };
+  push(t.getInitial(), false, ""_u);
+
+  auto& transitions = t.getTransitions();
+  while(!todo.empty() && !wildcard)
+  {
+    if(seen.size() > LRX_ANCHORS_MAX_ITEMS)
+    {
+      wildcard = true;
+      break;
+    }
+    Item item = todo.back();
+    todo.pop_back();
+    auto from = transitions.find(item.state);
+    if(from == transitions.end())
+    {
+      continue;
+    }
+    for(auto& tr : from->second)
+    {
+      int32_t in = alphabet.decode(tr.first).first;
+      int32_t target = tr.second.first;
+      if(in == null_boundary)
+      {
+        // only taken at the start of a window, when a rule is alive anyway
+        continue;
+      }
+      else if(in == 0 || isCounter(alphabet, in))
+      {
+        push(target, item.any, item.lemma);
+      }
+      else if(isAffix(alphabet, in))
+      {
+        push(target, true, ""_u);
+      }
+      else if(in > 0 || in == any_char || in == any_upper || in == any_lower)
+      {
+        if(item.any || (in < 0 && item.lemma.empty()))
+        {
+          push(target, true, ""_u);
+        }
+        else if(in > 0)
+        {
+          UString lemma = item.lemma;
+          appendLower(lemma, in);
+          push(target, false, lemma);
+        }
+        else
+        {
+          wildcard = true;
+        }
+      }
+      else if(!item.any)
+      {
+        lemmas.insert(item.lemma);
+      }
+      else if(in == any_tag || in == word_boundary)
+      {
+        wildcard = true;
+      }
+      else
+      {
+        UString tag;
+        alphabet.getSymbol(tag, in);
+        tags.insert(tag);
+      }
+    }
+  }
+  if(wildcard)
+  {
+    lemmas.clear();
+    tags.clear();
+  }
+}
+
+void
+LRXAnchors::write(LRXFlatWriter &output) const
+{
+  output.value(wildcard ? 1 : 0);
+  output.strings(vector<UString>(lemmas.begin(), lemmas.end()));
+  output.strings(vector<UString>(tags.begin(), tags.end()));
+}
+
+void
+LRXAnchors::read(LRXFlatReader &input, Alphabet &alphabet)
+{
+  wildcard = input.value() != 0;
+  lemmas.clear();
+  tags.clear();
+  lemma_index.clear();
+  tag_index.clear();
+  for(auto& lemma : input.strings())
+  {
+    lemma_index.insert(lemma);
+    lemmas.insert(lemma);
+  }
+  for(auto& tag : input.strings())
+  {
+    if(alphabet.isSymbolDefined(tag))
+    {
+      tag_index.insert(alphabet(tag));
+    }
+    tags.insert(tag);
+  }
+}
+
+bool
+LRXAnchors::isWildcard() const
+{
+  return wildcard;
+}
+
+bool
+LRXAnchors::canStart(vector<int32_t> const &syms, UString &key) const
+{
+  if(wildcard)
+  {
+    return true;
+  }
+  key.clear();
+  size_t i = 0;
+  for(; i < syms.size() && syms[i] > 0; i++)
+  {
+    appendLower(key, syms[i]);
+  }
+  if(lemma_index.find(key) != lemma_index.end())
+  {
+    return true;
+  }
+  return i < syms.size() && tag_index.find(syms[i]) != tag_index.end();
+}
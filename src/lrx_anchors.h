@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_ANCHORS_H__
+#define __LRX_ANCHORS_H__
+
+#include <cstdio>
+#include <cstdint>
+#include <set>
+#include <unordered_set>
+#include <vector>
+
+#include <lttoolbox/alphabet.h>
+#include <lttoolbox/transducer.h>
+
+#include <lrx_flat.h>
+
+using namespace std;
+
+/**
+ * What the first word of a rule can look like, so that a word which
+ * cannot start any rule need not be stepped through the main transducer
+ * while no rule is alive. A rule starts either with a literal lemma, kept
+ * in lower case, or with a wildcard lemma followed by a literal tag; any
+ * other start makes the index a wildcard, which lets every word through.
+ * The check is conservative: a word that passes may still not match.
+ */
+class LRXAnchors
+{
+private:
+  bool wildcard = true;
+  set<UString> lemmas;
+  set<UString> tags;
+
+  // as looked up at runtime
+  unordered_set<UString> lemma_index;
+  unordered_set<int32_t> tag_index;
+
+public:
+  static size_t const LRX_ANCHORS_MAX_ITEMS;
+
+  /**
+   * Collect the anchors of the rules in t, before any <$$>
+   */
+  void build(Transducer &t, Alphabet &alphabet);
+
+  void write(LRXFlatWriter &output) const;
+  void read(LRXFlatReader &input, Alphabet &alphabet);
+
+  bool isWildcard() const;
+
+  /**
+   * Whether the tokenised word syms could be the first word of a rule;
+   * key is scratch space
+   */
+  bool canStart(vector<int32_t> const &syms, UString &key) const;
+};
+
+#endif /* __LRX_ANCHORS_H__ */
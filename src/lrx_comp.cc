@@ -28,7 +28,11 @@ void endProgram(char *name)
   if(name != NULL)
   {
     cout << basename(name) << " v" << PACKAGE_VERSION <<": build a selection transducer from a ruleset" << endl;
-    cout << "USAGE: " << basename(name) << " rule_file output_file" << endl;
+    cout << "USAGE: " << basename(name) << " [-p|-d] [-w] [-u] rule_file output_file" << endl;
+    cout << "  -p, --print-transducer  print the transducer" << endl;
+    cout << "  -d, --debug             print the transducer and debugging output" << endl;
+    cout << "  -w, --word-classes      step once per lexical unit at runtime" << endl;
+    cout << "  -u, --unroll-repeats    copy the contents of <repeat> rather than count them at runtime" << endl;
   }
   exit(EXIT_FAILURE);
 }
@@ -39,31 +43,37 @@ int main (int argc, char **argv)
 
   LRXCompiler compiler;
 
-  if(argc != 3 && argc != 4)
+  if(argc < 3)
   {
     endProgram(argv[0]);
   }
 
-  if(argc == 3)
+  for(int i = 1; i < argc - 2; i++)
   {
-    compiler.parse(argv[1]);
-    FILE *output = fopen(argv[2], "wb");
-    compiler.write(output);
-  }
-  else if(argc == 4)
-  {
-    if(strcmp(argv[1], "-p") == 0 || strcmp(argv[1], "--print-transducer") == 0)
+    if(strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--print-transducer") == 0)
     {
       compiler.setOutputGraph(true);
     }
-    if(strcmp(argv[1], "-d") == 0 || strcmp(argv[1], "--debug") == 0)
+    else if(strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0)
     {
       compiler.setOutputGraph(true);
       compiler.setDebugMode(true);
     }
-
-    compiler.parse(argv[2]);
-    FILE *output = fopen(argv[3], "wb");
-    compiler.write(output);
+    else if(strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--word-classes") == 0)
+    {
+      compiler.setWordMode(true);
+    }
+    else if(strcmp(argv[i], "-u") == 0 || strcmp(argv[i], "--unroll-repeats") == 0)
+    {
+      compiler.setUnrollRepeats(true);
+    }
+    else
+    {
+      endProgram(argv[0]);
+    }
   }
+
+  compiler.parse(argv[argc-2]);
+  FILE *output = fopen(argv[argc-1], "wb");
+  compiler.write(output);
 }
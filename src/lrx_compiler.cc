@@ -16,7 +16,10 @@
  */
 
 #include <lrx_compiler.h>
-#include <weight.h>
+#include <lrx_anchors.h>
+#include <lrx_flat.h>
+#include <lrx_matcher.h>
+#include <lrx_recogniser.h>
 #include <lttoolbox/string_utils.h>
 #include <lttoolbox/xml_walk_util.h>
 #include <lttoolbox/compression.h>
@@ -135,6 +138,18 @@ LRXCompiler::setOutputGraph(bool o)
   outputGraph = o;
 }
 
+void
+LRXCompiler::setWordMode(bool o)
+{
+  wordMode = o;
+}
+
+void
+LRXCompiler::setUnrollRepeats(bool o)
+{
+  unrollRepeats = o;
+}
+
 UString
 name(xmlNode* node)
 {
@@ -172,6 +187,22 @@ void
 LRXCompiler::parse(string const &fitxer)
 {
   procNode(load_xml(fitxer.c_str()));
+
+  // every rule ends on an epsilon:<N> transition into a final state, so
+  // that minimising keeps the rules apart; the symbols are included after
+  // all the others, so that write() can leave them out of the alphabet.
+  // A table of rule ids keyed on the final states would not survive
+  // minimize(), whose determinising of the reversed transducer merges
+  // every final state; LRXMatcher::build makes the symbols that table.
+  ruleSymbols = alphabet.size();
+  for(auto& end : ruleEnds)
+  {
+    UString ruleId = "<"_u + StringUtils::itoa(end.second) + ">"_u;
+    alphabet.includeSymbol(ruleId);
+    int32_t state = transducer.insertSingleTransduction(alphabet(0, alphabet(ruleId)), end.first);
+    transducer.setFinal(state);
+  }
+  ruleEnds.clear();
   transducer.minimize();
 }
 
@@ -261,16 +292,13 @@ LRXCompiler::procRule(xmlNode* node)
   currentState = transducer.insertNewSingleTransduction(alphabet(0, 0), currentState);
 
   currentRuleId++;
-  UString ruleId = "<"_u + StringUtils::itoa(currentRuleId) + ">"_u;
   weights[currentRuleId] = weight;
 
   debug("  rule: %d, weight: %.2f \n", currentRuleId, weight);
 
   compileSequence(node);
   currentState = transducer.insertSingleTransduction(word_boundary, currentState);
-  alphabet.includeSymbol(ruleId);
-  currentState = transducer.insertSingleTransduction(alphabet(0, alphabet(ruleId)), currentState);
-  transducer.setFinal(currentState);
+  ruleEnds.push_back(make_pair(currentState, currentRuleId));
   currentState = initialState;
 }
 
@@ -385,8 +413,15 @@ LRXCompiler::compileSpecifier(xmlNode* node, Transducer* t, int state,
       }
     }
   } else if (!suffix.empty()) {
-    state = add_loop(t, state, alphabet(any_char, 0), true);
-    state = add_str(t, state, alphabet, suffix);
+    if (t == &transducer && !key) {
+      // the literal is looked for in the whole lemma before it is read,
+      // so that only the rules it is found for loop over the lemma
+      state = t->insertSingleTransduction(alphabet(affixes.add(LRXAffixes::Suffix, suffix, alphabet), 0), state);
+      state = add_loop(t, state, alphabet(any_char, 0), false);
+    } else {
+      state = add_loop(t, state, alphabet(any_char, 0), true);
+      state = add_str(t, state, alphabet, suffix);
+    }
     if (key) {
       *key = *key + "<ANY_CHAR>"_u;
       *key = *key + suffix;
@@ -396,9 +431,14 @@ LRXCompiler::compileSpecifier(xmlNode* node, Transducer* t, int state,
       }
     }
   } else if (!contains.empty()) {
-    state = add_loop(t, state, alphabet(any_char, 0), true);
-    state = add_str(t, state, alphabet, contains);
-    state = add_loop(t, state, alphabet(any_char, 0), true);
+    if (t == &transducer && !key) {
+      state = t->insertSingleTransduction(alphabet(affixes.add(LRXAffixes::Contains, contains, alphabet), 0), state);
+      state = add_loop(t, state, alphabet(any_char, 0), false);
+    } else {
+      state = add_loop(t, state, alphabet(any_char, 0), true);
+      state = add_str(t, state, alphabet, contains);
+      state = add_loop(t, state, alphabet(any_char, 0), true);
+    }
     if (key) {
       *key = *key + "<ANY_CHAR>"_u;
       *key = *key + contains;
@@ -466,10 +506,38 @@ LRXCompiler::compileSpecifier(xmlNode* node, Transducer* t, int state,
 }
 
 
+int32_t
+LRXCompiler::wordClass(const UString& pattern, Transducer& t)
+{
+  auto it = word_classes.find(pattern);
+  if (it != word_classes.end()) {
+    return it->second;
+  }
+  UString sym = "<$w"_u + StringUtils::itoa(word_classes.size() + 1) + ">"_u;
+  alphabet.includeSymbol(sym);
+  words[sym] = t;
+  int32_t label = alphabet(alphabet(sym), 0);
+  word_classes[pattern] = label;
+  debug("        word class %S: %d\n", sym.c_str(), t.size());
+  return label;
+}
+
 void
 LRXCompiler::procMatch(xmlNode* node)
 {
-  currentState = compileSpecifier(node, &transducer, currentState, nullptr);
+  if (wordMode) {
+    // patterns that are spelt the same are the same class
+    UString pattern = "match:"_u + attr(node, LRX_COMPILER_LEMMA_ATTR, "*"_u) +
+      "/"_u + attr(node, LRX_COMPILER_SUFFIX_ATTR) +
+      "/"_u + attr(node, LRX_COMPILER_CONTAINS_ATTR) +
+      "/"_u + attr(node, LRX_COMPILER_CASE_ATTR) +
+      "/"_u + attr(node, LRX_COMPILER_TAGS_ATTR, "*"_u);
+    Transducer t;
+    t.setFinal(compileSpecifier(node, &t, t.getInitial(), nullptr));
+    currentState = transducer.insertSingleTransduction(wordClass(pattern, t), currentState);
+  } else {
+    currentState = compileSpecifier(node, &transducer, currentState, nullptr);
+  }
   currentState = transducer.insertSingleTransduction(word_boundary, currentState);
 
   bool empty = true;
@@ -527,6 +595,20 @@ LRXCompiler::procRepeat(xmlNode* node)
   currentState = initialState;
   compileSequence(node);
   transducer.setFinal(currentState);
+  if(!unrollRepeats && upto > 1)
+  {
+    // one copy of the body in a loop, with the times round it counted
+    // by lrx-proc
+    int32_t enter = counterSymbol(LRXMatcher::CounterEnter, 0);
+    int32_t next = counterSymbol(LRXMatcher::CounterNext, upto);
+    int32_t exit = counterSymbol(LRXMatcher::CounterExit, from);
+    int loop = temp.insertNewSingleTransduction(enter, oldstate);
+    int end = temp.insertTransducer(loop, transducer);
+    temp.linkStates(end, loop, next);
+    currentState = temp.insertNewSingleTransduction(exit, loop);
+    transducer = temp;
+    return;
+  }
   for(int i = 0; i < from; i++)
   {
     oldstate = temp.insertTransducer(oldstate, transducer);
@@ -541,6 +623,18 @@ LRXCompiler::procRepeat(xmlNode* node)
 }
 
 
+int32_t
+LRXCompiler::counterSymbol(LRXMatcher::CounterOp op, int32_t bound)
+{
+  UString sym = LRXMatcher::counterSymbol(op, bound);
+  if(!alphabet.isSymbolDefined(sym))
+  {
+    alphabet.includeSymbol(sym);
+  }
+  return alphabet(alphabet(sym), 0);
+}
+
+
 void
 LRXCompiler::procSeq(xmlNode* node)
 {
@@ -556,34 +650,112 @@ LRXCompiler::procSeq(xmlNode* node)
 void
 LRXCompiler::write(FILE *fst)
 {
-  alphabet.write(fst);
-
-  Compression::multibyte_write(recognisers.size(), fst);
+  vector<UString> keys;
+  vector<Transducer *> recs;
   for(auto& it : recognisers)
   {
-    Compression::string_write(it.first, fst);
     debug("+ %d => %S\n", it.second.size(), it.first.c_str());
     if (debugMode) {
       it.second.show(alphabet, debug_output, 0, false);
     }
-    it.second.write(fst);
+    keys.push_back(it.first);
+    recs.push_back(&it.second);
   }
+  LRXRecogniser recogniser;
+  recogniser.build(keys, recs, alphabet);
+  debug("recognisers: %d keys, %d states\n", (int)keys.size(), (int)recogniser.size());
+
+  // the patterns of the word classes, in a recogniser of their own
+  LRXRecogniser word_recogniser;
+  if(wordMode)
+  {
+    vector<UString> names;
+    vector<Transducer *> classes;
+    for(auto& it : words)
+    {
+      names.push_back(it.first);
+      classes.push_back(&it.second);
+    }
+    word_recogniser.build(names, classes, alphabet);
+    debug("word classes: %d, %d states\n", (int)names.size(), (int)word_recogniser.size());
+  }
+
+  // the words that can start a rule; in word mode the first step is on
+  // a word class, so every word has to be stepped
+  LRXAnchors anchors;
+  if(!wordMode)
+  {
+    anchors.build(transducer, alphabet);
+  }
+  debug("anchors: %s\n", anchors.isWildcard() ? "any word" : "some words");
 
-  Compression::string_write("main"_u, fst);
   if(outputGraph)
   {
     transducer.show(alphabet, debug_output, 0, false);
   }
-  transducer.write(fst);
+  LRXMatcher matcher;
+  matcher.build(transducer, alphabet);
 
+  // dense, indexed by rule id
+  vector<double> rule_weights;
   for(auto& it : weights)
   {
     debug("%.4f %d\n", it.second, it.first);
-    weight record{it.first, "", it.second};
-    weight_to_le(record);
-    fwrite((void *)&record, 1, sizeof(weight), fst);
+    if(it.first < 0)
+    {
+      continue;
+    }
+    if(static_cast<size_t>(it.first) >= rule_weights.size())
+    {
+      rule_weights.resize(it.first + 1, 0.0);
+    }
+    rule_weights[it.first] = it.second;
+  }
+
+  LRXFlatFile file;
+  LRXFlatWriter section;
+  // lrx-proc takes the rule ids from the matcher, not from the symbols
+  vector<UString> symbols;
+  for(int32_t i = 1; i <= ruleSymbols; i++)
+  {
+    symbols.push_back(UString());
+    alphabet.getSymbol(symbols.back(), -i);
+  }
+  section.strings(symbols);
+  file.add(LRX_FLAT_ALPHABET, section);
+
+  section = LRXFlatWriter();
+  recogniser.write(section);
+  file.add(LRX_FLAT_RECOGNISER, section);
+
+  if(wordMode)
+  {
+    section = LRXFlatWriter();
+    word_recogniser.write(section);
+    file.add(LRX_FLAT_WORDS, section);
+  }
+
+  section = LRXFlatWriter();
+  anchors.write(section);
+  file.add(LRX_FLAT_ANCHORS, section);
+
+  section = LRXFlatWriter();
+  matcher.write(section);
+  file.add(LRX_FLAT_MATCHER, section);
+
+  section = LRXFlatWriter();
+  section.array(rule_weights);
+  file.add(LRX_FLAT_WEIGHTS, section);
+
+  if(!affixes.empty())
+  {
+    section = LRXFlatWriter();
+    affixes.write(section);
+    file.add(LRX_FLAT_AFFIXES, section);
   }
 
+  file.write(fst);
+
   if(!outputGraph)
   {
     u_fprintf(debug_output, "%d: %d@%d\n", currentRuleId, transducer.size(), transducer.numberOfTransitions());
@@ -637,25 +809,35 @@ LRXCompiler::procSet(xmlNode* node)
   if (loc == sets.end()) {
     error_and_die(node, "Undefined set %S.", name.c_str());
   }
-  currentState = transducer.insertTransducer(currentState, *(loc->second.first));
+  // in word mode the set is compiled on its own, as a word class
+  Transducer word;
+  Transducer* t = (wordMode ? &word : &transducer);
+  int state = (wordMode ? word.getInitial() : currentState);
+  state = t->insertTransducer(state, *(loc->second.first));
   UString tags = attr(node, LRX_COMPILER_TAGS_ATTR, loc->second.second);
   for (auto& it : StringUtils::split(tags, "."_u)) {
     if (it.empty()) continue;
     UString tag = "<"_u + it + ">"_u;
     if ((!globIsStar && tag == "<*>"_u) ||
         tag == "<+>"_u) {
-      currentState = add_loop(&transducer, currentState, alphabet(any_tag, 0), false);
+      state = add_loop(t, state, alphabet(any_tag, 0), false);
     } else if (globIsStar && tag == "<*>"_u) {
-      currentState = add_loop(&transducer, currentState, alphabet(any_tag, 0), true);
+      state = add_loop(t, state, alphabet(any_tag, 0), true);
     } else if (tag == "<?>"_u) {
-      currentState = transducer.insertSingleTransduction(alphabet(any_tag, 0), currentState);
+      state = t->insertSingleTransduction(alphabet(any_tag, 0), state);
     } else {
       if (!alphabet.isSymbolDefined(tag)) {
         alphabet.includeSymbol(tag);
       }
-      currentState = transducer.insertSingleTransduction(alphabet(alphabet(tag), 0), currentState);
+      state = t->insertSingleTransduction(alphabet(alphabet(tag), 0), state);
     }
   }
+  if (wordMode) {
+    word.setFinal(state);
+    currentState = transducer.insertSingleTransduction(wordClass("set:"_u + name + "/"_u + tags, word), currentState);
+  } else {
+    currentState = state;
+  }
   currentState = transducer.insertSingleTransduction(word_boundary, currentState);
   currentState = transducer.insertSingleTransduction(skip_sym, currentState);
 }
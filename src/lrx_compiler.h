@@ -26,6 +26,9 @@
 #include <lttoolbox/alphabet.h>
 #include <unicode/ustdio.h>
 
+#include <lrx_affixes.h>
+#include <lrx_matcher.h>
+
 using namespace std;
 
 class LRXCompiler
@@ -35,7 +38,10 @@ private:
   Transducer transducer;
 
   map<UString, Transducer> recognisers; // keyed on pattern
+  map<UString, Transducer> words; // keyed on word class symbol
+  map<UString, int32_t> word_classes; // pattern -> word class transition
   map<int32_t, double> weights; // keyed on rule id
+  LRXAffixes affixes; // the suffix= and contains= of the main transducer
 
   map<UString, Transducer> sequences;
   map<UString, pair<Transducer*, UString>> sets;
@@ -49,6 +55,8 @@ private:
   int32_t currentState;
 
   int32_t currentRuleId = 0;
+  vector<pair<int32_t, int32_t>> ruleEnds; // the last state of each rule, and its id
+  int32_t ruleSymbols = 0; // the symbols before the "<N>" of the rules
 
   int32_t any_tag = 0;
   int32_t any_char = 0;
@@ -61,6 +69,8 @@ private:
   int32_t skip_sym = 0;
 
   bool globIsStar = false;
+  bool wordMode = false;
+  bool unrollRepeats = false;
 
   bool debugMode = false;
   bool outputGraph = false;
@@ -79,9 +89,11 @@ private:
   void procOr(xmlNode* node);
   int compileSpecifier(xmlNode* node, Transducer* t, int state, UString* key);
   void compileSequence(xmlNode* node);
+  int32_t wordClass(const UString& pattern, Transducer& t);
   void procMatch(xmlNode* node);
   void procSelectRemove(xmlNode* node);
   void procRepeat(xmlNode* node);
+  int32_t counterSymbol(LRXMatcher::CounterOp op, int32_t bound);
   void procSeq(xmlNode* node);
   void procMacro(xmlNode* node);
   void procSet(xmlNode* node);
@@ -150,6 +162,20 @@ public:
   void setOutputGraph(bool o);
   void setDebugMode(bool o);
 
+  /**
+   * Compile each <match> and <set> to a single transition on a word
+   * class, and the patterns of the classes to a recogniser of their own,
+   * so that lrx-proc takes one step per lexical unit
+   */
+  void setWordMode(bool o);
+
+  /**
+   * Compile <repeat> by copying its contents as many times as it can
+   * match, rather than by a loop that lrx-proc counts the times round;
+   * it is always done for an upto of 1 or less, where a copy is no bigger
+   */
+  void setUnrollRepeats(bool o);
+
 };
 
 #endif /* __LRX_COMPILER_H__ */
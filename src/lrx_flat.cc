@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_flat.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+char const LRXFlatFile::LRX_FLAT_MAGIC[8] = {'\xff', 'L', 'R', 'X', 'F', 'L', 'A', 'T'};
+uint32_t const LRXFlatFile::LRX_FLAT_VERSION = 1;
+
+// magic, version, section count and checksum
+static size_t const LRX_FLAT_HEADER_SIZE = 24;
+static size_t const LRX_FLAT_ENTRY_SIZE = 24;
+
+static void
+putLE(string &out, uint64_t v, size_t bytes)
+{
+  for(size_t i = 0; i < bytes; i++)
+  {
+    out += static_cast<char>((v >> (8 * i)) & 0xFF);
+  }
+}
+
+static uint64_t
+getLE(char const *in, size_t bytes)
+{
+  uint64_t v = 0;
+  for(size_t i = 0; i < bytes; i++)
+  {
+    v |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+  }
+  return v;
+}
+
+static void
+pad(string &out)
+{
+  while(out.size() % 8 != 0)
+  {
+    out += '\0';
+  }
+}
+
+[[noreturn]] static void
+invalid(char const *what)
+{
+  cerr << "Error: Invalid rules binary (" << what << ")." << endl;
+  exit(EXIT_FAILURE);
+}
+
+void
+LRXFlatWriter::append(void const *data, size_t size, size_t item_size)
+{
+  char const *from = static_cast<char const *>(data);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  for(size_t i = 0; i < size; i += item_size)
+  {
+    for(size_t j = item_size; j > 0; j--)
+    {
+      bytes += from[i + j - 1];
+    }
+  }
+#else
+  bytes.append(from, size);
+#endif
+  pad(bytes);
+}
+
+void
+LRXFlatWriter::value(uint64_t v)
+{
+  putLE(bytes, v, 8);
+}
+
+void
+LRXFlatWriter::strings(vector<UString> const &items)
+{
+  vector<uint32_t> offsets(1, 0);
+  UString chars;
+  for(auto& item : items)
+  {
+    chars += item;
+    offsets.push_back(chars.size());
+  }
+  array(offsets);
+  array(chars.data(), chars.size());
+}
+
+string const &
+LRXFlatWriter::str() const
+{
+  return bytes;
+}
+
+LRXFlatReader::LRXFlatReader()
+{
+}
+
+LRXFlatReader::LRXFlatReader(shared_ptr<void const> const &o, char const *d, size_t s) :
+owner(o),
+data(d),
+size(s)
+{
+}
+
+void
+LRXFlatReader::truncated()
+{
+  invalid("truncated section");
+}
+
+void const *
+LRXFlatReader::take(size_t bytes, size_t item_size)
+{
+  size_t padded = (bytes + 7) / 8 * 8;
+  if(padded > size - pos)
+  {
+    truncated();
+  }
+  void const *result = data + pos;
+  pos += padded;
+  return result;
+}
+
+uint64_t
+LRXFlatReader::value()
+{
+  return getLE(static_cast<char const *>(take(8, 8)), 8);
+}
+
+vector<UString>
+LRXFlatReader::strings()
+{
+  auto offsets = array<uint32_t>();
+  auto chars = array<UChar>();
+  vector<UString> result;
+  for(size_t i = 0; i + 1 < offsets.size(); i++)
+  {
+    if(offsets[i] > offsets[i+1] || offsets[i+1] > chars.size())
+    {
+      invalid("bad string table");
+    }
+    result.push_back(UString(chars.begin() + offsets[i], chars.begin() + offsets[i+1]));
+  }
+  return result;
+}
+
+bool
+LRXFlatReader::done() const
+{
+  return pos >= size;
+}
+
+char const *
+LRXFlatReader::begin() const
+{
+  return data;
+}
+
+size_t
+LRXFlatReader::length() const
+{
+  return size;
+}
+
+uint64_t
+LRXFlatFile::checksum(char const *data, size_t size)
+{
+  // FNV-1a, a word at a time
+  uint64_t h = 0xcbf29ce484222325ULL;
+  size_t i = 0;
+  for(; i + 8 <= size; i += 8)
+  {
+    h = (h ^ getLE(data + i, 8)) * 0x100000001b3ULL;
+  }
+  for(; i < size; i++)
+  {
+    h = (h ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+bool
+LRXFlatFile::isFlat(FILE *input)
+{
+  int c = fgetc(input);
+  if(c == EOF)
+  {
+    return false;
+  }
+  ungetc(c, input);
+  return c == static_cast<unsigned char>(LRX_FLAT_MAGIC[0]);
+}
+
+void
+LRXFlatFile::add(LRXFlatSection id, LRXFlatWriter const &section)
+{
+  added.push_back(make_pair(static_cast<uint32_t>(id), section.str()));
+}
+
+void
+LRXFlatFile::write(FILE *output)
+{
+  string body;
+  uint64_t offset = LRX_FLAT_HEADER_SIZE + added.size() * LRX_FLAT_ENTRY_SIZE;
+  for(auto& s : added)
+  {
+    putLE(body, s.first, 4);
+    putLE(body, 0, 4);
+    putLE(body, offset, 8);
+    putLE(body, s.second.size(), 8);
+    offset += (s.second.size() + 7) / 8 * 8;
+  }
+  for(auto& s : added)
+  {
+    body += s.second;
+    pad(body);
+  }
+
+  string header(LRX_FLAT_MAGIC, sizeof(LRX_FLAT_MAGIC));
+  putLE(header, LRX_FLAT_VERSION, 4);
+  putLE(header, added.size(), 4);
+  putLE(header, checksum(body.data(), body.size()), 8);
+  fwrite(header.data(), 1, header.size(), output);
+  fwrite(body.data(), 1, body.size(), output);
+}
+
+void
+LRXFlatFile::read(FILE *input)
+{
+  struct stat st;
+  int fd = fileno(input);
+  if(fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+     ftell(input) == 0 && st.st_size > 0)
+  {
+    size = st.st_size;
+    void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if(map != MAP_FAILED)
+    {
+      size_t length = size;
+      owner = shared_ptr<void const>(map, [length](void const *p) {
+        munmap(const_cast<void *>(p), length);
+      });
+      data = static_cast<char const *>(map);
+    }
+  }
+  if(data == nullptr)
+  {
+    // not a regular file, so read it all into memory aligned as a map is
+    string bytes;
+    char buffer[1 << 16];
+    size_t n;
+    while((n = fread(buffer, 1, sizeof(buffer), input)) > 0)
+    {
+      bytes.append(buffer, n);
+    }
+    auto words = make_shared<vector<uint64_t>>((bytes.size() + 7) / 8);
+    if(!bytes.empty())
+    {
+      memcpy(words->data(), bytes.data(), bytes.size());
+    }
+    size = bytes.size();
+    data = reinterpret_cast<char const *>(words->data());
+    owner = words;
+  }
+
+  if(size < LRX_FLAT_HEADER_SIZE || memcmp(data, LRX_FLAT_MAGIC, sizeof(LRX_FLAT_MAGIC)) != 0)
+  {
+    invalid("bad header");
+  }
+  if(getLE(data + 8, 4) != LRX_FLAT_VERSION)
+  {
+    cerr << "Error: Rules binary format version " << getLE(data + 8, 4)
+         << " is not supported; recompile the rules with this version of lrx-comp." << endl;
+    exit(EXIT_FAILURE);
+  }
+  size_t count = getLE(data + 12, 4);
+  if(count > (size - LRX_FLAT_HEADER_SIZE) / LRX_FLAT_ENTRY_SIZE)
+  {
+    invalid("bad section table");
+  }
+  entries.clear();
+  for(size_t i = 0; i < count; i++)
+  {
+    char const *e = data + LRX_FLAT_HEADER_SIZE + i * LRX_FLAT_ENTRY_SIZE;
+    Entry entry{static_cast<uint32_t>(getLE(e, 4)), static_cast<uint32_t>(getLE(e + 4, 4)),
+                getLE(e + 8, 8), getLE(e + 16, 8)};
+    if(entry.offset % 8 != 0 || entry.offset > size || entry.size > size - entry.offset)
+    {
+      invalid("bad section table");
+    }
+    entries.push_back(entry);
+  }
+}
+
+void
+LRXFlatFile::verify() const
+{
+  if(checksum(data + LRX_FLAT_HEADER_SIZE, size - LRX_FLAT_HEADER_SIZE) != getLE(data + 16, 8))
+  {
+    invalid("checksum mismatch");
+  }
+}
+
+bool
+LRXFlatFile::has(LRXFlatSection id) const
+{
+  for(auto& e : entries)
+  {
+    if(e.id == id)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+LRXFlatReader
+LRXFlatFile::section(LRXFlatSection id) const
+{
+  for(auto& e : entries)
+  {
+    if(e.id == id)
+    {
+      return LRXFlatReader(owner, data + e.offset, e.size);
+    }
+  }
+  invalid("missing section");
+}
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_FLAT_H__
+#define __LRX_FLAT_H__
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <lttoolbox/ustring.h>
+
+using namespace std;
+
+/**
+ * A read-only array which either owns its items or points into a loaded
+ * binary, which it then keeps loaded. Copies share the items, so that a
+ * copy of a loaded automaton costs next to nothing.
+ */
+template<typename T>
+class LRXFlatArray
+{
+private:
+  shared_ptr<void const> owner;
+  T const *items = nullptr;
+  size_t count = 0;
+
+public:
+  LRXFlatArray()
+  {
+  }
+
+  LRXFlatArray(vector<T> &&v)
+  {
+    auto p = make_shared<vector<T>>(std::move(v));
+    items = p->data();
+    count = p->size();
+    owner = p;
+  }
+
+  LRXFlatArray(shared_ptr<void const> const &o, T const *i, size_t c) :
+  owner(o),
+  items(i),
+  count(c)
+  {
+  }
+
+  size_t size() const
+  {
+    return count;
+  }
+
+  bool empty() const
+  {
+    return count == 0;
+  }
+
+  T const & operator[](size_t i) const
+  {
+    return items[i];
+  }
+
+  T const * begin() const
+  {
+    return items;
+  }
+
+  T const * end() const
+  {
+    return items + count;
+  }
+};
+
+/**
+ * The sections of a binary in the flat format; each is a sequence of
+ * values and arrays as LRXFlatWriter writes them
+ */
+enum LRXFlatSection : uint32_t
+{
+  LRX_FLAT_ALPHABET = 1,   // the symbols, as strings, in the order of their codes
+  LRX_FLAT_RECOGNISER = 2,
+  LRX_FLAT_WORDS = 3,      // only with lrx-comp -w
+  LRX_FLAT_ANCHORS = 4,
+  LRX_FLAT_MATCHER = 5,
+  LRX_FLAT_WEIGHTS = 6,
+  LRX_FLAT_AFFIXES = 7     // only with suffix= or contains=
+};
+
+/**
+ * Builds one section: 64-bit values, and arrays, each its item count
+ * followed by the items, padded to 8 bytes. Everything is little-endian.
+ */
+class LRXFlatWriter
+{
+private:
+  string bytes;
+
+  void append(void const *data, size_t size, size_t item_size);
+
+public:
+  void value(uint64_t v);
+
+  template<typename T>
+  void array(T const *items, size_t count)
+  {
+    value(count);
+    append(items, count * sizeof(T), sizeof(T));
+  }
+
+  template<typename T>
+  void array(vector<T> const &items)
+  {
+    array(items.data(), items.size());
+  }
+
+  template<typename T>
+  void array(LRXFlatArray<T> const &items)
+  {
+    array(items.begin(), items.size());
+  }
+
+  /**
+   * Strings, as the offsets of each in the characters of all
+   */
+  void strings(vector<UString> const &items);
+
+  string const & str() const;
+};
+
+/**
+ * Reads a section that LRXFlatWriter built, without copying the arrays
+ * on little-endian hosts
+ */
+class LRXFlatReader
+{
+private:
+  shared_ptr<void const> owner;
+  char const *data = nullptr;
+  size_t size = 0;
+  size_t pos = 0;
+
+  void const * take(size_t bytes, size_t item_size);
+  [[noreturn]] static void truncated();
+
+public:
+  LRXFlatReader();
+  LRXFlatReader(shared_ptr<void const> const &owner, char const *data, size_t size);
+
+  uint64_t value();
+
+  template<typename T>
+  LRXFlatArray<T> array()
+  {
+    uint64_t count = value();
+    if(count > (size - pos) / sizeof(T))
+    {
+      truncated();
+    }
+    T const *items = static_cast<T const *>(take(count * sizeof(T), sizeof(T)));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    vector<T> swapped(count);
+    for(size_t i = 0; i < count; i++)
+    {
+      unsigned char const *from = reinterpret_cast<unsigned char const *>(items + i);
+      unsigned char *to = reinterpret_cast<unsigned char *>(&swapped[i]);
+      for(size_t j = 0; j < sizeof(T); j++)
+      {
+        to[j] = from[sizeof(T) - 1 - j];
+      }
+    }
+    return LRXFlatArray<T>(std::move(swapped));
+#else
+    return LRXFlatArray<T>(owner, items, count);
+#endif
+  }
+
+  vector<UString> strings();
+
+  /**
+   * Whether the whole section has been read
+   */
+  bool done() const;
+
+  /**
+   * The bytes of the whole section
+   */
+  char const * begin() const;
+  size_t length() const;
+};
+
+/**
+ * A binary in the flat format: a header with a magic number, a version
+ * and a checksum, then a table of sections, each at an offset aligned to
+ * 8 bytes. The arrays of a loaded binary are used where they are, in
+ * memory mapped from the file when it is a regular file, so that
+ * processes loading the same rules share its pages. The magic number
+ * starts with a byte that no binary in the older format starts with.
+ */
+class LRXFlatFile
+{
+private:
+  struct Entry
+  {
+    uint32_t id;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  shared_ptr<void const> owner;
+  char const *data = nullptr;
+  size_t size = 0;
+  vector<Entry> entries;
+  vector<pair<uint32_t, string>> added;
+
+  static uint64_t checksum(char const *data, size_t size);
+
+public:
+  static char const LRX_FLAT_MAGIC[8];
+  static uint32_t const LRX_FLAT_VERSION;
+
+  /**
+   * Whether input, which is not moved, is at the start of a binary in
+   * the flat format
+   */
+  static bool isFlat(FILE *input);
+
+  void add(LRXFlatSection id, LRXFlatWriter const &section);
+  void write(FILE *output);
+
+  /**
+   * Load the binary at the start of input, which is then no longer
+   * needed; exits with an error if its header or section table is not
+   * valid. The sections are only read as they are used.
+   */
+  void read(FILE *input);
+
+  /**
+   * Exit with an error if the sections do not match the checksum, which
+   * reads every page of the binary
+   */
+  void verify() const;
+
+  bool has(LRXFlatSection id) const;
+  LRXFlatReader section(LRXFlatSection id) const;
+};
+
+#endif /* __LRX_FLAT_H__ */
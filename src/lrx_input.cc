@@ -0,0 +1,534 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_input.h>
+#include <lrx_output.h>
+#include <lrx_window.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unicode/utf8.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+size_t const LRXInput::LRX_INPUT_BLOCK_SIZE = 1 << 20;
+
+static char const LRX_INPUT_SEGMENT_DELIMS[] = {'\\', '<', '/', '$'};
+static char const LRX_INPUT_TAG_DELIMS[] = {'\\', '>'};
+static char const LRX_INPUT_BLANK_DELIMS[] = {'^', '\n', '\0'};
+static char const LRX_INPUT_BLANK_ENDS[] = {'^', '\0'};
+
+// the first of the count bytes delims in [p, e), or e
+static const char *
+scan(const char *p, const char *e, const char *delims, size_t count)
+{
+#if defined(__AVX2__)
+  while(e - p >= 32)
+  {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i m = _mm256_setzero_si256();
+    for(size_t i = 0; i < count; i++)
+    {
+      m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(delims[i])));
+    }
+    uint32_t bits = _mm256_movemask_epi8(m);
+    if(bits)
+    {
+      return p + __builtin_ctz(bits);
+    }
+    p += 32;
+  }
+#endif
+#if defined(__SSE2__)
+  while(e - p >= 16)
+  {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i m = _mm_setzero_si128();
+    for(size_t i = 0; i < count; i++)
+    {
+      m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(delims[i])));
+    }
+    uint32_t bits = _mm_movemask_epi8(m);
+    if(bits)
+    {
+      return p + __builtin_ctz(bits);
+    }
+    p += 16;
+  }
+#endif
+  for(; p < e; p++)
+  {
+    for(size_t i = 0; i < count; i++)
+    {
+      if(*p == delims[i])
+      {
+        return p;
+      }
+    }
+  }
+  return e;
+}
+
+// whether [p, e) is valid UTF-8
+static bool
+valid(const char *p, const char *e)
+{
+  while(p < e)
+  {
+#if defined(__SSE2__)
+    while(e - p >= 16 &&
+          !_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))))
+    {
+      p += 16;
+    }
+    if(p == e)
+    {
+      break;
+    }
+#endif
+    if(static_cast<uint8_t>(*p) < 0x80)
+    {
+      p++;
+      continue;
+    }
+    int32_t i = 0;
+    int32_t length = static_cast<int32_t>(min<ptrdiff_t>(e - p, 4));
+    UChar32 cp;
+    U8_NEXT(reinterpret_cast<const uint8_t *>(p), i, length, cp);
+    if(cp < 0)
+    {
+      return false;
+    }
+    p += i;
+  }
+  return true;
+}
+
+LRXInput::LRXInput()
+{
+  // standard input, read in blocks until open() says otherwise
+  fd = 0;
+  more = true;
+}
+
+LRXInput::~LRXInput()
+{
+  close();
+}
+
+bool
+LRXInput::open(const char *path)
+{
+  close();
+  if(path == nullptr)
+  {
+    fd = 0;
+  }
+  else
+  {
+    fd = ::open(path, O_RDONLY);
+    if(fd < 0)
+    {
+      return false;
+    }
+    owned = true;
+  }
+  attach();
+  return true;
+}
+
+void
+LRXInput::open_fd(int input)
+{
+  close();
+  fd = input;
+  attach();
+}
+
+void
+LRXInput::tie(LRXOutput *output)
+{
+  tied = output;
+}
+
+bool
+LRXInput::failed() const
+{
+  return error != 0;
+}
+
+void
+LRXInput::attach()
+{
+  more = true;
+
+  struct stat st;
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+  {
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if(offset >= 0 && st.st_size > offset)
+    {
+      void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(m != MAP_FAILED)
+      {
+        madvise(m, st.st_size, MADV_SEQUENTIAL);
+        map = static_cast<char *>(m);
+        map_size = st.st_size;
+        cur = map + offset;
+        end = map + map_size;
+        more = false;
+      }
+    }
+  }
+}
+
+void
+LRXInput::open_or_exit(const char *path)
+{
+  if(!open(path))
+  {
+    cerr << "Error: Unable to open '" << path << "' for reading." << endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+void
+LRXInput::open_in_memory(const char *data, size_t size)
+{
+  close();
+  cur = data;
+  end = data + size;
+}
+
+void
+LRXInput::close()
+{
+  if(map != nullptr)
+  {
+    munmap(map, map_size);
+  }
+  if(owned)
+  {
+    ::close(fd);
+  }
+  fd = -1;
+  owned = false;
+  map = nullptr;
+  map_size = 0;
+  cur = nullptr;
+  end = nullptr;
+  more = false;
+  error = 0;
+  buffer_size = 0;
+  at_eof = false;
+  last = nullptr;
+}
+
+void
+LRXInput::refill()
+{
+  if(!more)
+  {
+    return;
+  }
+  last = nullptr;
+  size_t left = end - cur;
+  if(block.size() < LRX_INPUT_BLOCK_SIZE)
+  {
+    vector<char> bigger(LRX_INPUT_BLOCK_SIZE);
+    if(left)
+    {
+      memcpy(bigger.data(), cur, left);
+    }
+    block.swap(bigger);
+  }
+  else if(left)
+  {
+    memmove(block.data(), cur, left);
+  }
+  if(tied != nullptr)
+  {
+    tied->sync();
+  }
+  ssize_t n;
+  do
+  {
+    n = read(fd, block.data() + left, block.size() - left);
+  }
+  while(n < 0 && errno == EINTR);
+  if(n < 0)
+  {
+    error = errno;
+  }
+  if(n <= 0)
+  {
+    more = false;
+    n = 0;
+  }
+  cur = block.data();
+  end = cur + left + n;
+}
+
+const char *
+LRXInput::copy(const char *from, const char *to, string &out) const
+{
+  // valid UTF-8 is appended a run at a time
+  const char *run = from;
+  const char *p = from;
+  while(p < to)
+  {
+#if defined(__SSE2__)
+    // skip ASCII 16 bytes at a time
+    while(to - p >= 16 &&
+          !_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))))
+    {
+      p += 16;
+    }
+    if(p == to)
+    {
+      break;
+    }
+#endif
+    uint8_t c = *p;
+    if(c < 0x80)
+    {
+      p++;
+      continue;
+    }
+    if(to == end && more && U8_COUNT_TRAIL_BYTES(c) >= to - p)
+    {
+      // the rest of it hasn't been read yet
+      break;
+    }
+    int32_t i = 0;
+    int32_t length = static_cast<int32_t>(min<ptrdiff_t>(to - p, 4));
+    UChar32 cp;
+    U8_NEXT(reinterpret_cast<const uint8_t *>(p), i, length, cp);
+    if(cp < 0)
+    {
+      out.append(run, p - run);
+      out += "\xEF\xBF\xBD";
+      run = p + i;
+    }
+    p += i;
+  }
+  out.append(run, p - run);
+  return p;
+}
+
+void
+LRXInput::internal_read()
+{
+  if(buffer_size)
+  {
+    return;
+  }
+  if(cur == end)
+  {
+    refill();
+  }
+  if(cur == end)
+  {
+    at_eof = true;
+    ubuffer[buffer_size++] = U_EOF;
+    return;
+  }
+  uint8_t c = *cur;
+  if(c < 0x80)
+  {
+    ubuffer[buffer_size++] = c;
+    last = cur;
+    cur++;
+    return;
+  }
+  while(more && U8_COUNT_TRAIL_BYTES(c) >= end - cur)
+  {
+    refill();
+  }
+  last = cur;
+  int32_t i = 0;
+  int32_t length = static_cast<int32_t>(min<ptrdiff_t>(end - cur, 4));
+  UChar32 cp;
+  U8_NEXT(reinterpret_cast<const uint8_t *>(cur), i, length, cp);
+  cur += i;
+  ubuffer[buffer_size++] = (cp < 0 ? 0xFFFD : cp);
+}
+
+bool
+LRXInput::eof()
+{
+  return at_eof && buffer_size == 0;
+}
+
+UChar32
+LRXInput::get()
+{
+  if(!buffer_size)
+  {
+    internal_read();
+  }
+  return ubuffer[--buffer_size];
+}
+
+UChar32
+LRXInput::peek()
+{
+  if(!buffer_size)
+  {
+    internal_read();
+  }
+  return ubuffer[buffer_size - 1];
+}
+
+void
+LRXInput::unget(UChar32 c)
+{
+  ubuffer[buffer_size++] = c;
+}
+
+void
+LRXInput::readUntil(const char *delims, size_t count, string &out)
+{
+  while(buffer_size == 0)
+  {
+    if(cur == end)
+    {
+      if(!more)
+      {
+        return;
+      }
+      refill();
+      continue;
+    }
+    const char *stop = scan(cur, end, delims, count);
+    cur = copy(cur, stop, out);
+    if(cur != end && cur == stop)
+    {
+      return;
+    }
+    if(cur != stop)
+    {
+      // a character cut off by the end of the block
+      refill();
+    }
+  }
+}
+
+void
+LRXInput::readSegment(string &seg)
+{
+  bool escaped = false;
+  while(!eof())
+  {
+    if(!escaped)
+    {
+      readUntil(LRX_INPUT_SEGMENT_DELIMS, sizeof(LRX_INPUT_SEGMENT_DELIMS), seg);
+    }
+    UChar32 c = get();
+    if(escaped)
+    {
+      LRXWindow::append(seg, c);
+      escaped = false;
+    }
+    else if(c == '\\')
+    {
+      LRXWindow::append(seg, c);
+      escaped = true;
+    }
+    else if(c == '<')
+    {
+      // as InputFile::readBlock('<', '>')
+      LRXWindow::append(seg, c);
+      while(!eof())
+      {
+        readUntil(LRX_INPUT_TAG_DELIMS, sizeof(LRX_INPUT_TAG_DELIMS), seg);
+        UChar32 t = get();
+        if(t == U_EOF)
+        {
+          break;
+        }
+        LRXWindow::append(seg, t);
+        if(t == '\\')
+        {
+          LRXWindow::append(seg, get());
+        }
+        else if(t == '>')
+        {
+          break;
+        }
+      }
+    }
+    else if(c == '/' || c == '$')
+    {
+      unget(c);
+      break;
+    }
+    else
+    {
+      LRXWindow::append(seg, c);
+    }
+  }
+}
+
+size_t
+LRXInput::readBlank(string &out)
+{
+  size_t newlines = 0;
+  while(true)
+  {
+    readUntil(LRX_INPUT_BLANK_DELIMS, sizeof(LRX_INPUT_BLANK_DELIMS), out);
+    if(buffer_size != 0 || cur == end || *cur != '\n')
+    {
+      return newlines;
+    }
+    out += '\n';
+    cur++;
+    newlines++;
+  }
+}
+
+bool
+LRXInput::readBlankInPlace(UChar32 c, const char *&text, size_t &length,
+                           size_t &newlines)
+{
+  if(more || buffer_size != 0 || last == nullptr || last + 1 != cur ||
+     static_cast<uint8_t>(*last) != c)
+  {
+    return false;
+  }
+  const char *stop = scan(cur, end, LRX_INPUT_BLANK_ENDS, sizeof(LRX_INPUT_BLANK_ENDS));
+  if(!valid(cur, stop))
+  {
+    return false;
+  }
+  text = last;
+  length = stop - last;
+  newlines = count(cur, stop, '\n');
+  cur = stop;
+  return true;
+}
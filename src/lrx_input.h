@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_INPUT_H__
+#define __LRX_INPUT_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <lttoolbox/ustring.h>
+
+using namespace std;
+
+class LRXOutput;
+
+/**
+ * The UTF-8 input of lrx-proc. A regular file is mapped, and anything
+ * else is read in large blocks, with as much as read() gives so that
+ * NUL-flushed input is answered as it comes. Besides reading a character
+ * at a time with the same results as lttoolbox's InputFile, the text of
+ * a lexical unit or blank can be appended to a string up to its next
+ * delimiter, which is looked for 16 or 32 bytes at a time where SSE2 or
+ * AVX2 is there. That text stays UTF-8: only what is not valid UTF-8 is
+ * changed, to U+FFFD, as decoding it would.
+ */
+class LRXInput
+{
+private:
+  int fd = -1;
+  bool owned = false; // whether fd is closed with the input
+  char *map = nullptr;
+  size_t map_size = 0;
+  vector<char> block;
+
+  // the bytes read and not yet taken; more is whether read() may still
+  // give some after them
+  const char *cur = nullptr;
+  const char *end = nullptr;
+  bool more = false;
+  int error = 0; // errno of the read() that failed, which ended the input
+  const char *last = nullptr; // where the last character read started
+  LRXOutput *tied = nullptr;
+
+  // as InputFile: characters given back, and whether a read has gone
+  // past the end
+  UChar32 ubuffer[3];
+  unsigned int buffer_size = 0;
+  bool at_eof = false;
+
+  void attach(); // map fd if it is a regular file, or else read it in blocks
+  void refill();
+  void internal_read();
+
+  /**
+   * Append the characters of [from, to) to out, stopping before a
+   * sequence that is cut off by the end of what has been read so far;
+   * return where it stopped
+   */
+  const char * copy(const char *from, const char *to, string &out) const;
+
+  /**
+   * Append the characters of the input to out up to the first of delims,
+   * which must be ASCII and is not taken
+   */
+  void readUntil(const char *delims, size_t count, string &out);
+
+public:
+  static size_t const LRX_INPUT_BLOCK_SIZE;
+
+  LRXInput();
+  ~LRXInput();
+
+  LRXInput(LRXInput const &) = delete;
+  LRXInput & operator=(LRXInput const &) = delete;
+
+  /**
+   * Read the file at path, or standard input if it is null
+   */
+  bool open(const char *path = nullptr);
+  void open_or_exit(const char *path);
+
+  /**
+   * Read the descriptor fd, such as a socket, which is left open
+   */
+  void open_fd(int fd);
+
+  /**
+   * Read the size bytes at data, which must stay there until the input
+   * is closed; NULs are read like any other character
+   */
+  void open_in_memory(const char *data, size_t size);
+  void close();
+
+  /**
+   * Sync output, if not null, each time before read() is waited on, as
+   * cin is tied to cout, so that the reader of the output gets what was
+   * written for the input so far
+   */
+  void tie(LRXOutput *output);
+
+  /**
+   * Whether the input was ended by a read() that failed, such as one
+   * timed out on a socket, rather than by its end
+   */
+  bool failed() const;
+
+  // as InputFile
+  bool eof();
+  UChar32 get();
+  UChar32 peek();
+  void unget(UChar32 c);
+
+  /**
+   * Append a lexical form to seg up to the / or $ after it, as
+   * LRXProcessor reads it from an InputFile: a \ escapes the next
+   * character, and a tag runs to its >
+   */
+  void readSegment(string &seg);
+
+  /**
+   * Append the text of a blank to out up to the next ^ or NUL, or the end
+   * of the input, and return the number of newlines in it
+   */
+  size_t readBlank(string &out);
+
+  /**
+   * Where the bytes read stay put until the input is closed, as with a
+   * mapped file or input in memory, and c is the character just read,
+   * take the blank c starts as readBlank would, without copying it: set
+   * text and length to its bytes, c's included, and newlines to the
+   * number of newlines after c. Gives false, taking nothing, otherwise
+   * or where the blank is not valid UTF-8.
+   */
+  bool readBlankInPlace(UChar32 c, const char *&text, size_t &length,
+                        size_t &newlines);
+};
+
+#endif /* __LRX_INPUT_H__ */
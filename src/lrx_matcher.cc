@@ -0,0 +1,1161 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_matcher.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <lttoolbox/string_utils.h>
+
+using namespace std;
+
+size_t const LRXMatcher::LRX_MATCHER_MAX_PATHS = 1 << 20;
+size_t const LRXMatcher::LRX_MATCHER_MAX_DFA_STATES = 1 << 12;
+size_t const LRXMatcher::LRX_MATCHER_MAX_LOG = 1 << 16;
+
+// the N of a "<N>" rule id symbol, or -1
+static int32_t
+ruleId(const UString &sym)
+{
+  if(sym.size() < 3 || sym.size() > 11 || sym[0] != '<' || sym[sym.size()-1] != '>')
+  {
+    return -1;
+  }
+  int64_t rule = 0;
+  for(size_t i = 1; i + 1 < sym.size(); i++)
+  {
+    if(sym[i] < '0' || sym[i] > '9')
+    {
+      return -1;
+    }
+    rule = rule * 10 + (sym[i] - '0');
+  }
+  return rule > INT32_MAX ? -1 : rule;
+}
+
+UString
+LRXMatcher::counterSymbol(CounterOp op, int32_t bound)
+{
+  if(op == CounterEnter)
+  {
+    return "<{>"_u;
+  }
+  return (op == CounterNext ? "<+"_u : "<}"_u) + StringUtils::itoa(bound) + ">"_u;
+}
+
+int32_t
+LRXMatcher::counterGuard(const UString &symbol)
+{
+  if(symbol == "<{>"_u)
+  {
+    return CounterEnter;
+  }
+  if(symbol.size() < 4 || symbol[0] != '<' || (symbol[1] != '+' && symbol[1] != '}'))
+  {
+    return 0;
+  }
+  int32_t bound = ruleId("<"_u + symbol.substr(2));
+  if(bound < 0 || bound > (INT32_MAX >> 2))
+  {
+    return 0;
+  }
+  return (symbol[1] == '+' ? CounterNext : CounterExit) | bound << 2;
+}
+
+static inline uint64_t
+pathKey(int32_t parent, int32_t symbol)
+{
+  return (static_cast<uint64_t>(static_cast<uint32_t>(parent)) << 32) |
+         static_cast<uint32_t>(symbol);
+}
+
+static bool
+operator<(const LRXMatcher::Alive &a, const LRXMatcher::Alive &b)
+{
+  return a.state < b.state || (a.state == b.state && (a.path < b.path ||
+         (a.path == b.path && a.counters < b.counters)));
+}
+
+static bool
+operator==(const LRXMatcher::Alive &a, const LRXMatcher::Alive &b)
+{
+  return a.state == b.state && a.path == b.path && a.counters == b.counters;
+}
+
+void
+LRXMatcher::read(FILE *input, Alphabet const &alphabet)
+{
+  Transducer t;
+  t.read(input);
+  build(t, alphabet);
+}
+
+void
+LRXMatcher::build(Transducer &t, Alphabet const &alphabet)
+{
+  auto& transitions = t.getTransitions();
+  auto& t_finals = t.getFinals();
+
+  // lrx-comp ends every rule with an epsilon:<N> transition into a final
+  // state, which keeps the rules apart when the transducer is minimised;
+  // the state before it is made final instead, with N as its rule id. A
+  // state can end several rules, and still have other transitions, where
+  // rules are the same or one is the start of another.
+  UString sym;
+  auto ruleEnd = [&](int32_t tag, int32_t target) {
+    auto io = alphabet.decode(tag);
+    auto target_trans = transitions.find(target);
+    if(io.first != 0 || io.second >= 0 || t_finals.find(target) == t_finals.end() ||
+       (target_trans != transitions.end() && !target_trans->second.empty()))
+    {
+      return -1;
+    }
+    sym.clear();
+    alphabet.getSymbol(sym, io.second);
+    return ruleId(sym);
+  };
+
+  // number the states breadth-first from the initial one, so that the
+  // states stepped through together tend to be stored together; states
+  // that can't be reached, such as those the rule ids led to, are dropped
+  vector<int32_t> number(t.size(), -1);
+  vector<int32_t> order;
+  multimap<int32_t, int32_t> rules;
+  number[t.getInitial()] = 0;
+  order.push_back(t.getInitial());
+  for(size_t i = 0; i < order.size(); i++)
+  {
+    for(auto& tr : transitions[order[i]])
+    {
+      int32_t target = tr.second.first;
+      int32_t rule = ruleEnd(tr.first, target);
+      if(rule >= 0)
+      {
+        rules.insert(make_pair(order[i], rule));
+      }
+      else if(number[target] < 0)
+      {
+        number[target] = order.size();
+        order.push_back(target);
+      }
+    }
+  }
+
+  vector<uint32_t> offsets(1, 0);
+  vector<int32_t> inputs;
+  vector<int32_t> outputs;
+  vector<int32_t> targets;
+  vector<uint8_t> finals(order.size(), 0);
+  for(auto& f : t_finals)
+  {
+    if(number[f.first] >= 0)
+    {
+      finals[number[f.first]] = 1;
+    }
+  }
+  vector<pair<int32_t, int32_t>> state_rules;
+  for(auto& r : rules)
+  {
+    finals[number[r.first]] = 1;
+    state_rules.push_back(make_pair(number[r.first], r.second));
+  }
+  sort(state_rules.begin(), state_rules.end());
+  vector<int32_t> rule_states;
+  vector<int32_t> rule_ids;
+  for(auto& r : state_rules)
+  {
+    rule_states.push_back(r.first);
+    rule_ids.push_back(r.second);
+  }
+
+  struct Trans
+  {
+    int32_t input, output, target, guard;
+  };
+  vector<Trans> out;
+  vector<int32_t> guards;
+  bool counted = false;
+  map<int32_t, int32_t> symbol_guards;
+  for(auto& state : order)
+  {
+    out.clear();
+    for(auto& tr : transitions[state])
+    {
+      if(rules.find(state) != rules.end() && ruleEnd(tr.first, tr.second.first) >= 0)
+      {
+        continue;
+      }
+      auto io = alphabet.decode(tr.first);
+      int32_t guard = 0;
+      if(io.first < 0)
+      {
+        auto it = symbol_guards.find(io.first);
+        if(it == symbol_guards.end())
+        {
+          sym.clear();
+          alphabet.getSymbol(sym, io.first);
+          it = symbol_guards.insert(make_pair(io.first, counterGuard(sym))).first;
+        }
+        guard = it->second;
+      }
+      if(guard != 0)
+      {
+        io.first = 0;
+        counted = true;
+      }
+      out.push_back({io.first, io.second, number[tr.second.first], guard});
+    }
+    stable_sort(out.begin(), out.end(),
+                [](const Trans &a, const Trans &b) { return a.input < b.input; });
+    for(auto& tr : out)
+    {
+      inputs.push_back(tr.input);
+      outputs.push_back(tr.output);
+      targets.push_back(tr.target);
+      guards.push_back(tr.guard);
+    }
+    offsets.push_back(inputs.size());
+  }
+
+  initial = 0;
+  this->offsets = std::move(offsets);
+  this->inputs = std::move(inputs);
+  this->outputs = std::move(outputs);
+  this->targets = std::move(targets);
+  this->finals = std::move(finals);
+  this->rule_states = std::move(rule_states);
+  this->rule_ids = std::move(rule_ids);
+  if(!counted)
+  {
+    guards.clear();
+  }
+  this->guards = std::move(guards);
+  start();
+}
+
+void
+LRXMatcher::write(LRXFlatWriter &output) const
+{
+  output.value(initial);
+  output.array(offsets);
+  output.array(inputs);
+  output.array(outputs);
+  output.array(targets);
+  output.array(finals);
+  output.array(rule_states);
+  output.array(rule_ids);
+  output.array(guards);
+}
+
+void
+LRXMatcher::read(LRXFlatReader &input)
+{
+  initial = input.value();
+  offsets = input.array<uint32_t>();
+  inputs = input.array<int32_t>();
+  outputs = input.array<int32_t>();
+  targets = input.array<int32_t>();
+  finals = input.array<uint8_t>();
+  if(input.done())
+  {
+    // written before rule ids were taken out of the transducer
+    rule_states = LRXFlatArray<int32_t>();
+    rule_ids = LRXFlatArray<int32_t>();
+  }
+  else
+  {
+    rule_states = input.array<int32_t>();
+    rule_ids = input.array<int32_t>();
+  }
+  guards = input.done() ? LRXFlatArray<int32_t>() : input.array<int32_t>();
+  if(rule_states.size() != rule_ids.size() ||offsets.empty() || finals.size() != offsets.size() - 1 ||
+     static_cast<size_t>(initial) >= finals.size() ||
+     inputs.size() != outputs.size() || inputs.size() != targets.size() ||
+     offsets[offsets.size() - 1] != inputs.size() ||
+     (!guards.empty() && guards.size() != inputs.size()))
+  {
+    cerr << "Error: Invalid rules binary (bad transducer)." << endl;
+    exit(EXIT_FAILURE);
+  }
+  start();
+}
+
+pair<size_t, size_t>
+LRXMatcher::rulesOf(int32_t state) const
+{
+  auto range = equal_range(rule_states.begin(), rule_states.end(), state);
+  return make_pair(range.first - rule_states.begin(), range.second - rule_states.begin());
+}
+
+void
+LRXMatcher::start()
+{
+  path_parent.assign(1, -1);
+  path_symbol.assign(1, 0);
+  path_words.assign(1, 0);
+  path_ids.clear();
+
+  counter_parent.assign(1, -1);
+  counter_value.assign(1, 0);
+  counter_ids.clear();
+
+  class_offsets.assign(1, 0);
+  class_inputs.clear();
+  class_ids.clear();
+
+  alive.clear();
+  alive.push_back({initial, 0, 0});
+  closure();
+  initial_alive = alive;
+  initial_paths = path_parent.size();
+}
+
+int32_t
+LRXMatcher::extend(int32_t path, int32_t symbol)
+{
+  if(symbol == 0)
+  {
+    return path;
+  }
+  uint64_t key = pathKey(path, symbol);
+  auto it = path_ids.find(key);
+  if(it != path_ids.end())
+  {
+    return it->second;
+  }
+  int32_t id = path_parent.size();
+  path_parent.push_back(path);
+  path_symbol.push_back(symbol);
+  path_words.push_back(path_words[path] + (symbol == word_boundary ? 1 : 0));
+  path_ids[key] = id;
+  return id;
+}
+
+int32_t
+LRXMatcher::pushCounter(int32_t counters, int32_t value)
+{
+  uint64_t key = pathKey(counters, value);
+  auto it = counter_ids.find(key);
+  if(it != counter_ids.end())
+  {
+    return it->second;
+  }
+  int32_t id = counter_parent.size();
+  counter_parent.push_back(counters);
+  counter_value.push_back(value);
+  counter_ids[key] = id;
+  return id;
+}
+
+int32_t
+LRXMatcher::count(int32_t counters, int32_t guard)
+{
+  int32_t bound = guard >> 2;
+  switch(guard & 3)
+  {
+    case CounterEnter:
+      return pushCounter(counters, 0);
+    case CounterNext:
+      if(counters == 0 || counter_value[counters] >= bound)
+      {
+        return -1;
+      }
+      return pushCounter(counter_parent[counters], counter_value[counters] + 1);
+    case CounterExit:
+      if(counters == 0 || counter_value[counters] < bound)
+      {
+        return -1;
+      }
+      return counter_parent[counters];
+  }
+  return -1;
+}
+
+void
+LRXMatcher::apply(int32_t input)
+{
+  for(auto& a : alive)
+  {
+    auto begin = inputs.begin() + offsets[a.state];
+    auto end = inputs.begin() + offsets[a.state+1];
+    auto it = lower_bound(begin, end, input);
+    for(; it != end && *it == input; it++)
+    {
+      size_t t = it - inputs.begin();
+      next.push_back({targets[t], extend(a.path, outputs[t]), a.counters});
+    }
+  }
+}
+
+void
+LRXMatcher::closure()
+{
+  for(size_t i = 0; i < alive.size(); i++)
+  {
+    Alive a = alive[i];
+    auto begin = inputs.begin() + offsets[a.state];
+    auto end = inputs.begin() + offsets[a.state+1];
+    auto it = lower_bound(begin, end, 0);
+    for(; it != end && *it == 0; it++)
+    {
+      size_t t = it - inputs.begin();
+      int32_t counters = a.counters;
+      if(!guards.empty() && guards[t] != 0)
+      {
+        counters = count(counters, guards[t]);
+        if(counters < 0)
+        {
+          continue;
+        }
+      }
+      alive.push_back({targets[t], extend(a.path, outputs[t]), counters});
+    }
+  }
+  sort(alive.begin(), alive.end());
+  alive.erase(unique(alive.begin(), alive.end()), alive.end());
+}
+
+void
+LRXMatcher::compact()
+{
+  // re-intern the outputs of the alive states, dropping every path made
+  // since read() that they don't use
+  symbols.clear();
+  live.clear();
+  for(auto& a : alive)
+  {
+    size_t start = symbols.size();
+    int32_t p = a.path;
+    for(; p >= static_cast<int32_t>(initial_paths); p = path_parent[p])
+    {
+      symbols.push_back(path_symbol[p]);
+    }
+    live.push_back(make_pair(p, symbols.size() - start));
+  }
+  for(size_t i = initial_paths; i < path_parent.size(); i++)
+  {
+    path_ids.erase(pathKey(path_parent[i], path_symbol[i]));
+  }
+  path_parent.resize(initial_paths);
+  path_symbol.resize(initial_paths);
+  path_words.resize(initial_paths);
+  size_t k = 0;
+  for(size_t i = 0; i < alive.size(); i++)
+  {
+    int32_t p = live[i].first;
+    for(size_t j = k + live[i].second; j > k; j--)
+    {
+      p = extend(p, symbols[j-1]);
+    }
+    k += live[i].second;
+    alive[i].path = p;
+  }
+}
+
+void
+LRXMatcher::prune()
+{
+  beam_order.resize(alive.size());
+  for(size_t i = 0; i < alive.size(); i++)
+  {
+    beam_order[i] = i;
+  }
+  // a total order, so what is kept depends on nothing but alive
+  auto better = [&](uint32_t a, uint32_t b) {
+    uint32_t ra = state_ranks[alive[a].state];
+    uint32_t rb = state_ranks[alive[b].state];
+    return ra < rb || (ra == rb && a < b);
+  };
+  nth_element(beam_order.begin(), beam_order.begin() + beam, beam_order.end(), better);
+  for(auto it = beam_order.begin() + beam; it != beam_order.end(); it++)
+  {
+    int32_t rule = state_rules[alive[*it].state];
+    if(rule >= 0)
+    {
+      if(static_cast<size_t>(rule) >= rule_prunes.size())
+      {
+        rule_prunes.resize(rule + 1, 0);
+      }
+      rule_prunes[rule]++;
+    }
+    alive[*it].state = -1;
+  }
+  beam_prunes++;
+  beam_dropped += alive.size() - beam;
+  alive.erase(remove_if(alive.begin(), alive.end(), [](Alive const &a) { return a.state < 0; }),
+              alive.end());
+}
+
+void
+LRXMatcher::setEngine(Engine e, size_t max_states)
+{
+  engine = e;
+  max_dfa_states = max(max_states, static_cast<size_t>(2));
+}
+
+void
+LRXMatcher::setBeam(size_t max_alive, LRXFlatArray<double> const &weights)
+{
+  beam = max_alive;
+  if(beam == 0)
+  {
+    return;
+  }
+  if(engine != NFA)
+  {
+    cerr << "WARNING: Only the nfa engine keeps a beam, using nfa instead" << endl;
+    if(deferred)
+    {
+      sync();
+      deferred = false;
+    }
+    engine = NFA;
+  }
+
+  // the rules, heaviest first
+  vector<int32_t> rules(rule_ids.begin(), rule_ids.end());
+  sort(rules.begin(), rules.end());
+  rules.erase(unique(rules.begin(), rules.end()), rules.end());
+  auto weight = [&](int32_t rule) {
+    return static_cast<size_t>(rule) < weights.size() ? weights[rule] : 0.0;
+  };
+  sort(rules.begin(), rules.end(), [&](int32_t a, int32_t b) {
+    return weight(a) > weight(b) || (weight(a) == weight(b) && a < b);
+  });
+  vector<uint32_t> ranks(rules.empty() ? 0 : *max_element(rules.begin(), rules.end()) + 1);
+  for(size_t i = 0; i < rules.size(); i++)
+  {
+    ranks[rules[i]] = i;
+  }
+
+  // the transitions backwards: the states before state i are
+  // [pred_offsets[i], pred_offsets[i+1]) of preds
+  size_t states = offsets.size() - 1;
+  vector<uint32_t> pred_offsets(states + 1, 0);
+  vector<int32_t> preds(targets.size());
+  for(auto& target : targets)
+  {
+    pred_offsets[target+1]++;
+  }
+  for(size_t i = 0; i < states; i++)
+  {
+    pred_offsets[i+1] += pred_offsets[i];
+  }
+  vector<uint32_t> fill(pred_offsets.begin(), pred_offsets.end() - 1);
+  for(size_t i = 0; i < states; i++)
+  {
+    for(uint32_t j = offsets[i]; j < offsets[i+1]; j++)
+    {
+      preds[fill[targets[j]]++] = i;
+    }
+  }
+
+  // each rule, heaviest first, is the best rule of the states that can
+  // reach one of its final states and no heavier rule
+  vector<pair<uint32_t, int32_t>> seeds;
+  for(size_t i = 0; i < rule_states.size(); i++)
+  {
+    seeds.push_back(make_pair(ranks[rule_ids[i]], rule_states[i]));
+  }
+  sort(seeds.begin(), seeds.end());
+  state_rules.assign(states, -1);
+  state_ranks.assign(states, rules.size());
+  vector<int32_t> todo;
+  for(auto& seed : seeds)
+  {
+    if(state_rules[seed.second] >= 0)
+    {
+      continue;
+    }
+    state_rules[seed.second] = rules[seed.first];
+    state_ranks[seed.second] = seed.first;
+    todo.push_back(seed.second);
+    while(!todo.empty())
+    {
+      int32_t state = todo.back();
+      todo.pop_back();
+      for(uint32_t j = pred_offsets[state]; j < pred_offsets[state+1]; j++)
+      {
+        if(state_rules[preds[j]] < 0)
+        {
+          state_rules[preds[j]] = rules[seed.first];
+          state_ranks[preds[j]] = seed.first;
+          todo.push_back(preds[j]);
+        }
+      }
+    }
+  }
+}
+
+unsigned long
+LRXMatcher::prunes() const
+{
+  return beam_prunes;
+}
+
+void
+LRXMatcher::setWordBoundary(int32_t symbol)
+{
+  word_boundary = symbol;
+  // count them on the paths made so far
+  start();
+}
+
+void
+LRXMatcher::reset()
+{
+  alive = initial_alive;
+  pending.clear();
+  deferred = false;
+  if(engine == LazyDFA)
+  {
+    dfaStart();
+  }
+}
+
+void
+LRXMatcher::nfaFollow(const int32_t *alts, size_t count)
+{
+  next.clear();
+  for(size_t i = 0; i < count; i++)
+  {
+    if(alts[i] == 0)
+    {
+      alive.clear();
+      return;
+    }
+  }
+  for(size_t i = 0; i < count; i++)
+  {
+    apply(alts[i]);
+  }
+  alive.swap(next);
+  closure();
+}
+
+void
+LRXMatcher::nfaStep(const int32_t *alts, size_t count)
+{
+  nfaFollow(alts, count);
+  if(beam && alive.size() > beam)
+  {
+    prune();
+  }
+}
+
+void
+LRXMatcher::nfaStepOptional(const int32_t *inputs, size_t count)
+{
+  saved.assign(alive.begin(), alive.end());
+  nfaFollow(inputs, count);
+  alive.insert(alive.end(), saved.begin(), saved.end());
+  sort(alive.begin(), alive.end());
+  alive.erase(unique(alive.begin(), alive.end()), alive.end());
+  if(beam && alive.size() > beam)
+  {
+    prune();
+  }
+}
+
+void
+LRXMatcher::nfaMergeInitial()
+{
+  // once nothing is alive none of the paths made since read() are needed
+  if(alive.empty() || path_parent.size() > LRX_MATCHER_MAX_PATHS)
+  {
+    compact();
+  }
+  alive.insert(alive.end(), initial_alive.begin(), initial_alive.end());
+  sort(alive.begin(), alive.end());
+  alive.erase(unique(alive.begin(), alive.end()), alive.end());
+}
+
+void
+LRXMatcher::nfaOp(Op op, const int32_t *alts, size_t count)
+{
+  if(op == OpStep)
+  {
+    nfaStep(alts, count);
+  }
+  else if(op == OpStepOptional)
+  {
+    nfaStepOptional(alts, 1);
+  }
+  else if(op == OpStepClasses)
+  {
+    nfaStep(class_inputs.data() + class_offsets[alts[0]],
+            class_offsets[alts[0]+1] - class_offsets[alts[0]]);
+  }
+  else if(op == OpStepOptionalClasses)
+  {
+    nfaStepOptional(class_inputs.data() + class_offsets[alts[0]],
+                    class_offsets[alts[0]+1] - class_offsets[alts[0]]);
+  }
+  else
+  {
+    nfaMergeInitial();
+  }
+}
+
+void
+LRXMatcher::dfaStart()
+{
+  if(dfa_finals.empty())
+  {
+    subset.clear();
+    dfaStateFor(subset); // 0 is nothing alive
+    for(auto& a : initial_alive)
+    {
+      subset.push_back(a.state);
+    }
+    sort(subset.begin(), subset.end());
+    subset.erase(unique(subset.begin(), subset.end()), subset.end());
+    dfa_initial = dfaStateFor(subset);
+  }
+  dfa_state = dfa_initial;
+  deferred = true;
+}
+
+void
+LRXMatcher::subsetClosure(vector<int32_t> &states)
+{
+  // each state goes in once: without their guards the epsilons of a
+  // nested <repeat> make a cycle
+  subset_marks.resize(offsets.size() - 1, false);
+  size_t kept = 0;
+  for(auto& state : states)
+  {
+    if(!subset_marks[state])
+    {
+      subset_marks[state] = true;
+      states[kept++] = state;
+    }
+  }
+  states.resize(kept);
+  for(size_t i = 0; i < states.size(); i++)
+  {
+    int32_t state = states[i];
+    auto begin = inputs.begin() + offsets[state];
+    auto end = inputs.begin() + offsets[state+1];
+    auto it = lower_bound(begin, end, 0);
+    for(; it != end && *it == 0; it++)
+    {
+      int32_t target = targets[it - inputs.begin()];
+      if(!subset_marks[target])
+      {
+        subset_marks[target] = true;
+        states.push_back(target);
+      }
+    }
+  }
+  for(auto& state : states)
+  {
+    subset_marks[state] = false;
+  }
+  sort(states.begin(), states.end());
+}
+
+int32_t
+LRXMatcher::dfaStateFor(vector<int32_t> &states)
+{
+  auto it = dfa_ids.find(states);
+  if(it != dfa_ids.end())
+  {
+    return it->second;
+  }
+  if(dfa_finals.size() >= max_dfa_states)
+  {
+    return -1;
+  }
+  int32_t id = dfa_finals.size();
+  if(dfa_offsets.empty())
+  {
+    dfa_offsets.push_back(0);
+  }
+  bool final = false;
+  for(auto& state : states)
+  {
+    dfa_sets.push_back(state);
+    final = final || finals[state];
+  }
+  dfa_offsets.push_back(dfa_sets.size());
+  dfa_finals.push_back(final);
+  dfa_ids[states] = id;
+  return id;
+}
+
+bool
+LRXMatcher::dfaStep(Op op, const int32_t *alts, size_t count)
+{
+  uint64_t key = (static_cast<uint64_t>(dfa_state) << 38) |
+                 (static_cast<uint64_t>(op) << 35) |
+                 (static_cast<uint64_t>(count) << 32) |
+                 static_cast<uint32_t>(alts[0]);
+  int32_t target;
+  auto it = dfa_trans.find(key);
+  if(it != dfa_trans.end())
+  {
+    dfa_hits++;
+    target = it->second;
+  }
+  else
+  {
+    dfa_misses++;
+    auto from = dfa_sets.begin() + dfa_offsets[dfa_state];
+    auto to = dfa_sets.begin() + dfa_offsets[dfa_state+1];
+    subset.clear();
+    if(op == OpMergeInitial)
+    {
+      subset.assign(from, to);
+      subset.insert(subset.end(), dfa_sets.begin() + dfa_offsets[dfa_initial],
+                    dfa_sets.begin() + dfa_offsets[dfa_initial+1]);
+    }
+    else
+    {
+      const int32_t *syms = alts;
+      size_t n = count;
+      if(op == OpStepClasses || op == OpStepOptionalClasses)
+      {
+        syms = class_inputs.data() + class_offsets[alts[0]];
+        n = class_offsets[alts[0]+1] - class_offsets[alts[0]];
+      }
+      if(find(syms, syms + n, 0) != syms + n)
+      {
+        n = 0;
+      }
+      for(auto state = from; state != to; state++)
+      {
+        for(size_t i = 0; i < n; i++)
+        {
+          auto begin = inputs.begin() + offsets[*state];
+          auto end = inputs.begin() + offsets[*state+1];
+          auto tr = lower_bound(begin, end, syms[i]);
+          for(; tr != end && *tr == syms[i]; tr++)
+          {
+            subset.push_back(targets[tr - inputs.begin()]);
+          }
+        }
+      }
+      subsetClosure(subset);
+    }
+    if(op == OpStepOptional || op == OpStepOptionalClasses)
+    {
+      subset.insert(subset.end(), from, to);
+    }
+    sort(subset.begin(), subset.end());
+    subset.erase(unique(subset.begin(), subset.end()), subset.end());
+
+    target = dfaStateFor(subset);
+    if(target < 0)
+    {
+      // the cache is full: bring the paths up to date and follow them
+      // until nothing is alive
+      dfa_overflows++;
+      sync();
+      deferred = false;
+      dfa_offsets.clear();
+      dfa_sets.clear();
+      dfa_finals.clear();
+      dfa_ids.clear();
+      dfa_trans.clear();
+      nfaOp(op, alts, count);
+      return false;
+    }
+    dfa_trans[key] = target;
+  }
+  dfa_state = target;
+  return true;
+}
+
+void
+LRXMatcher::deferredStep(Op op, const int32_t *alts, size_t count)
+{
+  if(!dfaStep(op, alts, count))
+  {
+    return;
+  }
+
+  if(size() == 0)
+  {
+    // nothing to replay the steps on
+    alive.clear();
+    pending.clear();
+    return;
+  }
+  pending.push_back(op);
+  pending.push_back(count);
+  pending.insert(pending.end(), alts, alts + count);
+  if(pending.size() > LRX_MATCHER_MAX_LOG)
+  {
+    sync();
+  }
+}
+
+
+
+void
+LRXMatcher::sync()
+{
+  size_t i = 0;
+  while(i < pending.size())
+  {
+    size_t count = pending[i+1];
+    nfaOp(static_cast<Op>(pending[i]), &pending[i+2], count);
+    i += 2 + count;
+  }
+  pending.clear();
+}
+
+void
+LRXMatcher::step(const int32_t *alts, size_t count)
+{
+  if(deferred)
+  {
+    deferredStep(OpStep, alts, count);
+  }
+  else
+  {
+    nfaStep(alts, count);
+  }
+}
+
+void
+LRXMatcher::step(int32_t input)
+{
+  step(&input, 1);
+}
+
+int32_t
+LRXMatcher::classSet(vector<int32_t> const &classes)
+{
+  auto it = class_ids.find(classes);
+  if(it != class_ids.end())
+  {
+    return it->second;
+  }
+  int32_t id = class_offsets.size() - 1;
+  class_inputs.insert(class_inputs.end(), classes.begin(), classes.end());
+  class_offsets.push_back(class_inputs.size());
+  class_ids[classes] = id;
+  return id;
+}
+
+void
+LRXMatcher::stepClasses(int32_t set)
+{
+  if(deferred)
+  {
+    deferredStep(OpStepClasses, &set, 1);
+  }
+  else
+  {
+    nfaOp(OpStepClasses, &set, 1);
+  }
+}
+
+void
+LRXMatcher::stepOptional(int32_t input)
+{
+  if(deferred)
+  {
+    deferredStep(OpStepOptional, &input, 1);
+  }
+  else
+  {
+    nfaStepOptional(&input, 1);
+  }
+}
+
+void
+LRXMatcher::stepOptionalClasses(int32_t set)
+{
+  if(deferred)
+  {
+    deferredStep(OpStepOptionalClasses, &set, 1);
+  }
+  else
+  {
+    nfaOp(OpStepOptionalClasses, &set, 1);
+  }
+}
+
+void
+LRXMatcher::mergeInitial()
+{
+  if(engine == LazyDFA && !deferred && alive.empty())
+  {
+    dfaStart();
+    dfa_state = 0;
+  }
+  if(deferred)
+  {
+    int32_t none = 0;
+    deferredStep(OpMergeInitial, &none, 1);
+  }
+  else
+  {
+    nfaMergeInitial();
+  }
+}
+
+size_t
+LRXMatcher::size() const
+{
+  if(deferred && engine == LazyDFA)
+  {
+    return dfa_offsets[dfa_state+1] - dfa_offsets[dfa_state];
+  }
+  return alive.size();
+}
+
+bool
+LRXMatcher::isFinal() const
+{
+  if(deferred && engine == LazyDFA)
+  {
+    return dfa_finals[dfa_state];
+  }
+  for(auto& a : alive)
+  {
+    if(finals[a.state])
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t
+LRXMatcher::reach()
+{
+  sync();
+  size_t words = 0;
+  for(auto& a : alive)
+  {
+    words = max(words, static_cast<size_t>(path_words[a.path]));
+  }
+  return words;
+}
+
+bool
+LRXMatcher::synced() const
+{
+  return pending.empty();
+}
+
+void
+LRXMatcher::filterFinals(Alphabet const &alphabet, set<UChar32> const &escaped_chars,
+                         UString &result)
+{
+  sync();
+  vector<int32_t> syms;
+  for(auto& a : alive)
+  {
+    if(!finals[a.state])
+    {
+      continue;
+    }
+    syms.clear();
+    for(int32_t p = a.path; p > 0; p = path_parent[p])
+    {
+      syms.push_back(path_symbol[p]);
+    }
+    result += '/';
+    for(auto it = syms.rbegin(); it != syms.rend(); it++)
+    {
+      if(escaped_chars.find(*it) != escaped_chars.end())
+      {
+        result += '\\';
+      }
+      alphabet.getSymbol(result, *it);
+    }
+  }
+}
+
+void
+LRXMatcher::finalMatches(int32_t word_boundary,
+                         vector<Match> &matches,
+                         vector<pair<uint32_t, uint32_t>> &segments,
+                         vector<int32_t> &symbols)
+{
+  sync();
+  matches.clear();
+  segments.clear();
+  symbols.clear();
+  for(auto& a : alive)
+  {
+    if(!finals[a.state])
+    {
+      continue;
+    }
+    uint32_t start = symbols.size();
+    for(int32_t p = a.path; p > 0; p = path_parent[p])
+    {
+      symbols.push_back(path_symbol[p]);
+    }
+    reverse(symbols.begin() + start, symbols.end());
+
+    Match m;
+    m.begin = segments.size();
+    uint32_t from = start;
+    for(uint32_t i = start; i < symbols.size(); i++)
+    {
+      if(symbols[i] == word_boundary)
+      {
+        if(i > from)
+        {
+          segments.push_back(make_pair(from, i));
+        }
+        from = i + 1;
+      }
+    }
+    m.end = segments.size();
+    auto range = rulesOf(a.state);
+    m.rule = -1;
+    if(range.first == range.second)
+    {
+      matches.push_back(m);
+    }
+    for(size_t i = range.first; i < range.second; i++)
+    {
+      m.rule = rule_ids[i];
+      matches.push_back(m);
+    }
+  }
+}
+
+void
+LRXMatcher::printStats(ostream &out) const
+{
+  if(engine == LazyDFA)
+  {
+    out << "lazy dfa: " << dfa_finals.size() << " states, " << dfa_hits << " hits, ";
+    out << dfa_misses << " misses, " << dfa_overflows << " overflows" << endl;
+  }
+  if(beam)
+  {
+    out << "beam: " << beam_prunes << " prunes, " << beam_dropped << " paths dropped" << endl;
+    for(size_t i = 0; i < rule_prunes.size(); i++)
+    {
+      if(rule_prunes[i])
+      {
+        out << "beam: rule " << i << ": " << rule_prunes[i] << " paths dropped" << endl;
+      }
+    }
+  }
+}
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_MATCHER_H__
+#define __LRX_MATCHER_H__
+
+#include <cstdio>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include <lttoolbox/alphabet.h>
+#include <lttoolbox/transducer.h>
+
+#include <lrx_flat.h>
+
+using namespace std;
+
+/**
+ * Runs the main rule transducer over the input the way lttoolbox's State
+ * does, but over a flat copy of the automaton. The output of each alive
+ * path is an id in a table of shared prefixes, so taking a transition
+ * copies no sequence, and alive states are kept in reusable buffers, so
+ * stepping does not allocate once the buffers have grown.
+ *
+ * LazyDFA only follows which states are alive; the steps taken are
+ * logged and replayed on the alive paths only when their outputs are
+ * needed. It keeps one cached DFA state per set of alive states,
+ * built by subset construction the first time it is reached; when the
+ * cache is full the matcher goes back to following paths until nothing
+ * is alive, and then starts a new cache. The paths are still replayed at
+ * every final state, so where rules end often it is no faster than NFA.
+ */
+class LRXMatcher
+{
+public:
+  enum Engine { NFA, LazyDFA };
+
+  /**
+   * What lrx-comp puts around the body of a counted <repeat>: entering
+   * starts a count of the times the body has been gone through, next
+   * adds one to it if that doesn't go past its upper bound, and exit
+   * ends it if it has reached its lower bound
+   */
+  enum CounterOp { CounterEnter = 1, CounterNext = 2, CounterExit = 3 };
+
+  struct Alive
+  {
+    int32_t state;
+    int32_t path; // id of the output so far, 0 is the empty output
+    int32_t counters; // id of the counts of the repeats it is in, 0 for none
+  };
+
+  /**
+   * A rule matched in an alive final state: its id, or -1 for an output
+   * with no "<N>" after the last <$>, and its segments, the non-empty
+   * outputs between the <$>s before the last one
+   */
+  struct Match
+  {
+    int32_t rule;
+    uint32_t begin; // segments [begin, end) of finalMatches()
+    uint32_t end;
+  };
+
+private:
+  enum Op { OpStep, OpStepOptional, OpMergeInitial, OpStepClasses, OpStepOptionalClasses };
+
+  int32_t initial = 0;
+  // transitions of state i are [offsets[i], offsets[i+1]), sorted by input
+  LRXFlatArray<uint32_t> offsets;
+  LRXFlatArray<int32_t> inputs;
+  LRXFlatArray<int32_t> outputs;
+  LRXFlatArray<int32_t> targets;
+  LRXFlatArray<uint8_t> finals;
+  // the rules matched in each final state that ends some, as sorted pairs
+  LRXFlatArray<int32_t> rule_states;
+  LRXFlatArray<int32_t> rule_ids;
+  // the counter op of each transition, as op | bound << 2, or 0; such
+  // transitions are epsilons to the engines that only follow states,
+  // which keep a superset of the alive states, as the paths are only
+  // checked when replayed. Empty if there are no counted repeats.
+  LRXFlatArray<int32_t> guards;
+
+  // output paths: path i is path_parent[i] followed by path_symbol[i]
+  vector<int32_t> path_parent;
+  vector<int32_t> path_symbol;
+  vector<uint32_t> path_words; // how many word_boundary symbols path i has
+  int32_t word_boundary = 0;
+  unordered_map<uint64_t, int32_t> path_ids;
+  size_t initial_paths = 1; // the paths of the initial states come first
+
+  // counter stacks: stack i is counter_parent[i] with counter_value[i]
+  // on top; the counts are bounded, so there are only so many of them
+  vector<int32_t> counter_parent;
+  vector<int32_t> counter_value;
+  unordered_map<uint64_t, int32_t> counter_ids;
+
+  // class set i is the inputs [class_offsets[i], class_offsets[i+1])
+  vector<uint32_t> class_offsets;
+  vector<int32_t> class_inputs;
+  map<vector<int32_t>, int32_t> class_ids;
+
+  vector<Alive> alive;
+  vector<Alive> initial_alive;
+  vector<Alive> next;
+  vector<Alive> saved;
+  vector<int32_t> symbols;
+  vector<pair<int32_t, size_t>> live;
+
+  Engine engine = NFA;
+  size_t max_dfa_states = LRX_MATCHER_MAX_DFA_STATES;
+  bool deferred = false; // whether alive is behind, with the steps in pending
+  vector<int32_t> pending; // op, count, alts... since alive was up to date
+  // DFA state i is the set of NFA states [dfa_offsets[i], dfa_offsets[i+1])
+  vector<uint32_t> dfa_offsets;
+  vector<int32_t> dfa_sets;
+  vector<bool> dfa_finals;
+  map<vector<int32_t>, int32_t> dfa_ids;
+  unordered_map<uint64_t, int32_t> dfa_trans; // (state, op, input) -> state
+  int32_t dfa_state = 0;
+  int32_t dfa_initial = 0;
+  vector<int32_t> subset;
+  vector<bool> subset_marks; // by NFA state, those in the subset being closed
+  unsigned long dfa_hits = 0;
+  unsigned long dfa_misses = 0;
+  unsigned long dfa_overflows = 0;
+
+  // the beam: at most beam paths are kept after a step, those whose
+  // state can reach the heaviest rules first; state_rules is the best
+  // rule each state can reach, or -1, and state_ranks the rank of that
+  // rule, by weight and then id
+  size_t beam = 0;
+  vector<int32_t> state_rules;
+  vector<uint32_t> state_ranks;
+  vector<uint32_t> beam_order;
+  unsigned long beam_prunes = 0;
+  unsigned long beam_dropped = 0;
+  vector<unsigned long> rule_prunes; // paths dropped, by their best rule
+
+  void start();
+  pair<size_t, size_t> rulesOf(int32_t state) const;
+  int32_t extend(int32_t path, int32_t symbol);
+  int32_t pushCounter(int32_t counters, int32_t value);
+  int32_t count(int32_t counters, int32_t guard);
+  void apply(int32_t input);
+  void closure();
+  void compact();
+  void prune();
+
+  void nfaFollow(const int32_t *alts, size_t count);
+  void nfaStep(const int32_t *alts, size_t count);
+  void nfaStepOptional(const int32_t *inputs, size_t count);
+  void nfaMergeInitial();
+
+  void nfaOp(Op op, const int32_t *alts, size_t count);
+  void deferredStep(Op op, const int32_t *alts, size_t count);
+  void dfaStart();
+  bool dfaStep(Op op, const int32_t *alts, size_t count);
+  void subsetClosure(vector<int32_t> &states);
+  int32_t dfaStateFor(vector<int32_t> &states);
+  void sync();
+
+public:
+  static size_t const LRX_MATCHER_MAX_PATHS;
+  static size_t const LRX_MATCHER_MAX_DFA_STATES;
+  static size_t const LRX_MATCHER_MAX_LOG;
+
+  /**
+   * The symbol for op with bound, which build() takes out of the
+   * transducer, and the other way round, with 0 for a symbol that isn't
+   * one of them
+   */
+  static UString counterSymbol(CounterOp op, int32_t bound);
+  static int32_t counterGuard(UString const &symbol);
+
+  void read(FILE *input, Alphabet const &alphabet);
+  void build(Transducer &t, Alphabet const &alphabet);
+
+  /**
+   * In the flat format; a matcher read from it uses the arrays where
+   * they were loaded
+   */
+  void write(LRXFlatWriter &output) const;
+  void read(LRXFlatReader &input);
+
+  /**
+   * Choose how to run the transducer; max_states bounds the cache of
+   * the LazyDFA engine
+   */
+  void setEngine(Engine engine, size_t max_states = LRX_MATCHER_MAX_DFA_STATES);
+
+  /**
+   * Keep at most max_alive paths alive after each step, 0 meaning no
+   * bound. Past it, the paths dropped first are those that can reach no
+   * rule, then those whose heaviest reachable rule is lightest, by
+   * weights, indexed by rule id, then those of the highest rule ids and
+   * the latest in the order of the alive paths, so the same input always
+   * loses the same paths. Only the NFA engine keeps a beam, so any other
+   * falls back to it, with a warning.
+   */
+  void setBeam(size_t max_alive, LRXFlatArray<double> const &weights);
+
+  /**
+   * How many steps have gone past the beam
+   */
+  unsigned long prunes() const;
+
+  /**
+   * The output symbol that follows each word of a rule, which reach()
+   * counts
+   */
+  void setWordBoundary(int32_t symbol);
+
+  /**
+   * Start again from the initial state with an empty output
+   */
+  void reset();
+
+  /**
+   * Take the transitions on input and on each of its alternatives; the
+   * first of alts must be the input itself, and the rest must follow
+   * from it, as they do with LRXAlternatives. As with State::step, an
+   * input or alternative of 0 leaves nothing alive.
+   */
+  void step(const int32_t *alts, size_t count);
+  void step(int32_t input);
+
+  /**
+   * The id of a set of inputs, such as the word classes of a lexical
+   * unit, for stepClasses; ids stay valid until the matcher is read again
+   */
+  int32_t classSet(vector<int32_t> const &classes);
+
+  /**
+   * Take the transitions on every input of a class set; an empty set
+   * leaves nothing alive
+   */
+  void stepClasses(int32_t set);
+
+  /**
+   * As step, but the states alive before stepping stay alive
+   */
+  void stepOptional(int32_t input);
+
+  /**
+   * As stepClasses, but the states alive before stepping stay alive
+   */
+  void stepOptionalClasses(int32_t set);
+
+  /**
+   * Add the initial state to the alive states, as
+   * State::merge(initial_state) does
+   */
+  void mergeInitial();
+
+  size_t size() const;
+  bool isFinal() const;
+
+  /**
+   * How many words back the alive paths reach: the most word boundaries
+   * in the output of any of them. None of them can give an op to a word
+   * further back than that.
+   */
+  size_t reach();
+
+  /**
+   * Whether the alive paths are up to date, as they always are with NFA,
+   * so that reach() costs no more than a look at each of them; the other
+   * engines bring them up to date at final states and when their log of
+   * steps fills up
+   */
+  bool synced() const;
+
+  /**
+   * The outputs of the alive final states, separated by '/'
+   */
+  void filterFinals(Alphabet const &alphabet, set<UChar32> const &escaped_chars,
+                    UString &result);
+
+  /**
+   * The rules matched in the alive final states, as State::filterFinalsLRX
+   * gives them but without building strings, into buffers that are
+   * reused: segment i is the output symbols
+   * [segments[i].first, segments[i].second) of symbols. One match is
+   * given for each rule ended in each alive final state, in no
+   * particular order.
+   */
+  void finalMatches(int32_t word_boundary,
+                    vector<Match> &matches,
+                    vector<pair<uint32_t, uint32_t>> &segments,
+                    vector<int32_t> &symbols);
+
+  void printStats(ostream &out) const;
+};
+
+#endif /* __LRX_MATCHER_H__ */
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_output.h>
+
+using namespace std;
+
+size_t const LRXOutput::LRX_OUTPUT_BUFFER_SIZE = 1 << 16;
+
+void
+LRXOutput::open(FILE *f)
+{
+  file = f;
+  ring = nullptr;
+  flushed = false;
+  buffer.reserve(LRX_OUTPUT_BUFFER_SIZE);
+}
+
+void
+LRXOutput::open(LRXRing<Block> &r)
+{
+  file = nullptr;
+  ring = &r;
+  flushed = false;
+  buffer.reserve(LRX_OUTPUT_BUFFER_SIZE);
+}
+
+void
+LRXOutput::close()
+{
+  if(ring != nullptr)
+  {
+    flush();
+    Block& block = ring->back();
+    block.text.clear();
+    block.sync = true;
+    block.end = true;
+    ring->push();
+    ring = nullptr;
+  }
+}
+
+void
+LRXOutput::hand(bool sync)
+{
+  // the block's old text, which the writer is done with, is reused
+  Block& block = ring->back();
+  block.text.swap(buffer);
+  block.sync = sync;
+  flushed = !sync;
+  block.end = false;
+  ring->push();
+  buffer.clear();
+  buffer.reserve(LRX_OUTPUT_BUFFER_SIZE);
+}
+
+void
+LRXOutput::put(char c)
+{
+  buffer += c;
+  if(buffer.size() >= LRX_OUTPUT_BUFFER_SIZE)
+  {
+    flush();
+  }
+}
+
+void
+LRXOutput::write(const char *text, size_t length)
+{
+  if(length >= LRX_OUTPUT_BUFFER_SIZE && ring == nullptr)
+  {
+    flush();
+    fwrite(text, 1, length, file);
+    flushed = true;
+    return;
+  }
+  buffer.append(text, length);
+  if(buffer.size() >= LRX_OUTPUT_BUFFER_SIZE)
+  {
+    flush();
+  }
+}
+
+void
+LRXOutput::number(long value)
+{
+  char text[32];
+  int length = snprintf(text, sizeof(text), "%ld", value);
+  write(text, length);
+}
+
+void
+LRXOutput::flush()
+{
+  if(ring != nullptr)
+  {
+    if(!buffer.empty())
+    {
+      hand(false);
+    }
+  }
+  else if(!buffer.empty())
+  {
+    fwrite(buffer.data(), 1, buffer.size(), file);
+    buffer.clear();
+    flushed = true;
+  }
+}
+
+void
+LRXOutput::sync()
+{
+  if(buffer.empty() && !flushed)
+  {
+    return;
+  }
+  if(ring != nullptr)
+  {
+    hand(true);
+    return;
+  }
+  flush();
+  fflush(file);
+  flushed = false;
+}
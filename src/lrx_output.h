@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_OUTPUT_H__
+#define __LRX_OUTPUT_H__
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+#include <lrx_ring.h>
+
+using namespace std;
+
+/**
+ * What lrx-proc writes out, gathered in one buffer that is reused from
+ * one window to the next and given to the file in one call once it is
+ * full or flushed. Text at least as long as the buffer is written from
+ * where it is instead of being copied into it. The buffer can instead
+ * be handed to a writer thread, through a ring of blocks.
+ */
+class LRXOutput
+{
+public:
+  // a buffer handed to the writer thread
+  struct Block
+  {
+    string text;
+    bool sync = false; // the file is to be flushed after it
+    bool end = false;  // nothing comes after it
+  };
+
+private:
+  FILE *file = nullptr;
+  LRXRing<Block> *ring = nullptr;
+  string buffer;
+  bool flushed = false; // text has been given to the file since the last sync
+
+  void hand(bool sync);
+
+public:
+  static size_t const LRX_OUTPUT_BUFFER_SIZE;
+
+  /**
+   * Write to file from now on; what is left of the buffer must have been
+   * flushed
+   */
+  void open(FILE *file);
+
+  /**
+   * Hand the buffer to ring when it is flushed from now on, for a writer
+   * thread that writes each Block out and, after the last, ends
+   */
+  void open(LRXRing<Block> &ring);
+
+  /**
+   * Tell the writer thread of the ring there is no more
+   */
+  void close();
+
+  void put(char c);
+  void write(const char *text, size_t length);
+  void number(long value);
+
+  /**
+   * Give the buffer to the file
+   */
+  void flush();
+
+  /**
+   * Flush the buffer and the file too, for a reader that is waiting for
+   * the output; nothing is done if nothing was written since the last
+   */
+  void sync();
+};
+
+#endif /* __LRX_OUTPUT_H__ */
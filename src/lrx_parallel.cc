@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_parallel.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <unicode/ustdio.h>
+
+using namespace std;
+
+size_t const LRXParallel::LRX_PARALLEL_JOB_BYTES = 1 << 16;
+size_t const LRXParallel::LRX_PARALLEL_JOBS_PER_THREAD = 4;
+
+LRXParallel::LRXParallel(LRXProcessor const &p, LRXProcessor::Modes const &m,
+                         unsigned int j, bool s) :
+processor(p),
+modes(m),
+jobs(j),
+split_lines(s)
+{
+}
+
+void
+LRXParallel::run(Job &job, LRXProcessor::Stream &s)
+{
+  ostringstream log;
+  s.log = &log;
+  char *buffer = nullptr;
+  size_t size = 0;
+  FILE *mem = open_memstream(&buffer, &size);
+  UFILE *output = u_finit(mem, NULL, NULL);
+  for(auto& chunk : job.chunks)
+  {
+    if(!chunk.input.empty())
+    {
+      LRXInput input;
+      input.open_in_memory(chunk.input.data(), chunk.input.size());
+      s.lineno = chunk.lineno;
+      processor.process(s, input, output);
+    }
+    if(chunk.nul)
+    {
+      u_fputc('\0', output);
+    }
+  }
+  u_fclose(output);
+  fclose(mem);
+  job.output.assign(buffer, size);
+  free(buffer);
+  job.log = log.str();
+  job.chunks.clear();
+}
+
+void
+LRXParallel::work()
+{
+  LRXProcessor::Stream s;
+  processor.initStream(s, modes, cerr);
+  while(true)
+  {
+    Job *job;
+    {
+      unique_lock<mutex> l(lock);
+      changed.wait(l, [&] { return !todo.empty() || finished; });
+      if(todo.empty())
+      {
+        return;
+      }
+      job = todo.front();
+      todo.pop_front();
+    }
+    run(*job, s);
+    {
+      lock_guard<mutex> l(lock);
+      job->done = true;
+    }
+    changed.notify_all();
+  }
+}
+
+void
+LRXParallel::write(FILE *output, ostream &log)
+{
+  while(true)
+  {
+    Job *job;
+    {
+      unique_lock<mutex> l(lock);
+      changed.wait(l, [&] {
+        return (!order.empty() && order.front()->done) || (finished && order.empty());
+      });
+      if(order.empty())
+      {
+        return;
+      }
+      job = order.front();
+      order.pop_front();
+    }
+    changed.notify_all();
+    fwrite(job->output.data(), 1, job->output.size(), output);
+    log << job->log;
+    if(job->nul)
+    {
+      // as the single-threaded processor does after each NUL
+      fflush(output);
+    }
+    delete job;
+  }
+}
+
+void
+LRXParallel::submit(Job *job)
+{
+  {
+    unique_lock<mutex> l(lock);
+    changed.wait(l, [&] { return order.size() < jobs * LRX_PARALLEL_JOBS_PER_THREAD; });
+    todo.push_back(job);
+    order.push_back(job);
+  }
+  changed.notify_all();
+}
+
+bool
+LRXParallel::process(FILE *input, FILE *output, ostream &log)
+{
+  vector<thread> workers;
+  for(unsigned int i = 0; i < jobs; i++)
+  {
+    workers.emplace_back(&LRXParallel::work, this);
+  }
+  thread writer(&LRXParallel::write, this, output, ref(log));
+
+  // Follow the input as LRXProcessor::process reads it: outside a
+  // lexical unit only ^ and newlines mean anything, inside one \ escapes
+  // and a tag runs to its >
+  enum { Blank, Word, WordEscape, Tag, TagEscape } state = Blank;
+  bool newline = false;
+  unsigned long lineno = 1;
+  Job *job = new Job;
+  Chunk chunk;
+  bool any = false;
+  auto endChunk = [&]() {
+    job->bytes += chunk.input.size();
+    job->nul = job->nul || chunk.nul;
+    job->chunks.push_back(std::move(chunk));
+    chunk = Chunk();
+    chunk.lineno = lineno;
+    any = true;
+    if(job->bytes >= LRX_PARALLEL_JOB_BYTES)
+    {
+      submit(job);
+      job = new Job;
+    }
+  };
+
+  vector<char> buffer(LRX_PARALLEL_JOB_BYTES);
+  bool failed = false;
+  while(true)
+  {
+    ssize_t n = read(fileno(input), buffer.data(), buffer.size());
+    if(n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if(n <= 0)
+    {
+      failed = (n < 0);
+      break;
+    }
+    const char *block = buffer.data();
+    size_t from = 0;
+    for(size_t i = 0; i < static_cast<size_t>(n); i++)
+    {
+      char c = block[i];
+      if(c == '\0' && modes.nullFlush)
+      {
+        // the NUL is not part of either chunk; without -z it is only
+        // text, as LRXProcessor::process reads it
+        chunk.input.append(block + from, i - from);
+        from = i + 1;
+        chunk.nul = true;
+        endChunk();
+        state = Blank;
+        newline = false;
+        continue;
+      }
+      switch(state)
+      {
+        case Blank:
+          if(c == '^')
+          {
+            state = Word;
+          }
+          else if(c == '\n')
+          {
+            lineno++;
+            if(split_lines && newline)
+            {
+              chunk.input.append(block + from, i + 1 - from);
+              from = i + 1;
+              endChunk();
+              newline = false;
+              continue;
+            }
+          }
+          newline = (c == '\n');
+          break;
+        case Word:
+          if(c == '\\')
+          {
+            state = WordEscape;
+          }
+          else if(c == '<')
+          {
+            state = Tag;
+          }
+          else if(c == '$')
+          {
+            state = Blank;
+          }
+          break;
+        case WordEscape:
+          state = Word;
+          break;
+        case Tag:
+          if(c == '\\')
+          {
+            state = TagEscape;
+          }
+          else if(c == '>')
+          {
+            state = Word;
+          }
+          break;
+        case TagEscape:
+          state = Tag;
+          break;
+      }
+    }
+    chunk.input.append(block + from, n - from);
+    // don't hold back what has been read while waiting for more
+    if(!job->chunks.empty())
+    {
+      submit(job);
+      job = new Job;
+    }
+  }
+  if(!chunk.input.empty() || !any)
+  {
+    endChunk();
+  }
+  if(!job->chunks.empty())
+  {
+    submit(job);
+  }
+  else
+  {
+    delete job;
+  }
+
+  {
+    lock_guard<mutex> l(lock);
+    finished = true;
+  }
+  changed.notify_all();
+  for(auto& worker : workers)
+  {
+    worker.join();
+  }
+  writer.join();
+  fflush(output);
+  return !failed;
+}
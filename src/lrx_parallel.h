@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_PARALLEL_H__
+#define __LRX_PARALLEL_H__
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <lrx_processor.h>
+
+using namespace std;
+
+/**
+ * Processes one input with several threads, cut where no rule can be
+ * alive (at NULs with -z, and at blank lines if asked for) into pieces
+ * that are each processed as a stream of its own.
+ */
+class LRXParallel
+{
+private:
+  // a piece of input that starts a new stream
+  struct Chunk
+  {
+    string input; // UTF-8
+    bool nul = false; // the piece ended at a NUL, which is written after it
+    unsigned long lineno = 1;
+  };
+
+  // the chunks read in one go, processed by one worker
+  struct Job
+  {
+    vector<Chunk> chunks;
+    size_t bytes = 0;
+    string output;
+    string log;
+    bool nul = false;
+    bool done = false;
+  };
+
+  LRXProcessor const &processor;
+  LRXProcessor::Modes modes;
+  unsigned int jobs;
+  bool split_lines;
+
+  mutex lock;
+  condition_variable changed;
+  deque<Job *> todo;  // jobs no worker has taken yet
+  deque<Job *> order; // jobs not yet written, in input order
+  bool finished = false;
+
+  void work();
+  void run(Job &job, LRXProcessor::Stream &s);
+  void write(FILE *output, ostream &log);
+  void submit(Job *job);
+
+public:
+  static size_t const LRX_PARALLEL_JOB_BYTES;
+  static size_t const LRX_PARALLEL_JOBS_PER_THREAD;
+
+  /**
+   * Each piece is processed with modes; with split_lines, blank lines
+   * end a window as with -b
+   */
+  LRXParallel(LRXProcessor const &processor, LRXProcessor::Modes const &modes,
+              unsigned int jobs, bool split_lines);
+
+  /**
+   * Process input to output, writing the log of -t and -d to log; false
+   * if reading the input failed, which ends it
+   */
+  bool process(FILE *input, FILE *output, ostream &log);
+};
+
+#endif /* __LRX_PARALLEL_H__ */
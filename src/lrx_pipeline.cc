@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_pipeline.h>
+
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+size_t const LRXPipeline::LRX_PIPELINE_BLOCKS = 8;
+
+LRXPipeline::LRXPipeline(LRXProcessor const &p, LRXProcessor::Modes const &m) :
+processor(p),
+modes(m)
+{
+}
+
+void
+LRXPipeline::write(LRXRing<LRXOutput::Block> &blocks, FILE *output)
+{
+  while(true)
+  {
+    LRXOutput::Block& block = blocks.front();
+    fwrite(block.text.data(), 1, block.text.size(), output);
+    if(block.sync)
+    {
+      fflush(output);
+    }
+    bool end = block.end;
+    blocks.pop();
+    if(end)
+    {
+      return;
+    }
+  }
+}
+
+void
+LRXPipeline::process(LRXInput &input, UFILE *output)
+{
+  LRXProcessor::Stream s;
+  processor.initStream(s, modes, cerr);
+  u_fflush(output);
+  FILE *file = u_fgetfile(output);
+  // with a single core, nothing would overlap
+  if(file == nullptr || thread::hardware_concurrency() == 1)
+  {
+    processor.process(s, input, output);
+    return;
+  }
+
+  LRXRecords records;
+  LRXRing<LRXOutput::Block> blocks(LRX_PIPELINE_BLOCKS);
+  s.output.open(blocks);
+
+  thread reader(&LRXRecords::read, &records, ref(input), s.modes.nullFlush,
+                s.modes.maxWindowBytes == 0);
+  thread writer(&LRXPipeline::write, ref(blocks), file);
+  processor.process(s, records);
+  s.output.close();
+  reader.join();
+  writer.join();
+}
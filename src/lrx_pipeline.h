@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_PIPELINE_H__
+#define __LRX_PIPELINE_H__
+
+#include <cstdio>
+
+#include <unicode/ustdio.h>
+
+#include <lrx_input.h>
+#include <lrx_output.h>
+#include <lrx_processor.h>
+#include <lrx_records.h>
+#include <lrx_ring.h>
+
+using namespace std;
+
+/**
+ * Processes one input as a single stream, with the input parsed and the
+ * output written on threads of their own while the calling thread
+ * matches the rules.
+ */
+class LRXPipeline
+{
+private:
+  LRXProcessor const &processor;
+  LRXProcessor::Modes modes;
+
+  static void write(LRXRing<LRXOutput::Block> &blocks, FILE *output);
+
+public:
+  static size_t const LRX_PIPELINE_BLOCKS;
+
+  LRXPipeline(LRXProcessor const &processor, LRXProcessor::Modes const &modes);
+
+  /**
+   * Process input to output; without a FILE under output, or with a
+   * single core, this is done on the calling thread alone
+   */
+  void process(LRXInput &input, UFILE *output);
+};
+
+#endif /* __LRX_PIPELINE_H__ */
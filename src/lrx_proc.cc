@@ -14,12 +14,19 @@
  * You should have received a copy of the GNU General Public License
  * along with this program; if not, see <https://www.gnu.org/licenses/>.
  */
+#include <lrx_parallel.h>
+#include <lrx_pipeline.h>
 #include <lrx_processor.h>
+#include <lrx_server.h>
+#include <lrx_session.h>
 
 #include <lttoolbox/lt_locale.h>
 #include <lttoolbox/cli.h>
 #include <lttoolbox/file_utils.h>
 
+#include <fcntl.h>
+#include <thread>
+
 using namespace std;
 
 int main(int argc, char *argv[])
@@ -30,30 +37,185 @@ int main(int argc, char *argv[])
   cli.add_bool_arg('d', "debug", "print out information about which rules are run");
   cli.add_bool_arg('z', "null-flush", "flush on the null character");
   cli.add_bool_arg('m', "max-ent", "no-op (retained for backwards compatibility)");
+  cli.add_str_arg('e', "engine", "how to run the rules: nfa (default, and the fastest) or dfa (a lazily built DFA, to compare against)", "ENGINE");
+  cli.add_str_arg('j', "jobs", "process the input with N threads, cutting it at each NUL (with -z) or blank line (with -b); the input between two cuts is held and processed as one piece", "N");
+  cli.add_bool_arg('b', "blank-lines", "let blank lines end a window, so that rules do not match across them");
+  cli.add_bool_arg('p', "pipeline", "read the input and write the output on threads of their own, while the rules are matched (unless -j cuts the input)");
+  cli.add_str_arg('W', "max-window", "write out the window once it holds N words, even if rules are still matching", "N");
+  cli.add_str_arg('B', "max-window-bytes", "write out the window once its text takes more than N bytes, even if rules are still matching", "N");
+  cli.add_str_arg('A', "max-alive", "keep at most N paths of the rules alive, dropping those of the lightest rules (uses the nfa engine)", "N");
+  cli.add_bool_arg('V', "verify", "check the rules binary against its checksum before using it, which reads all of it");
+  cli.add_str_arg('s', "server", "load the rules once and serve them at the Unix domain socket SOCKET, taking each connection as an input of its own, on a pool of N threads with -j (the -t and -d log stays on the server's stderr)", "SOCKET");
+  cli.add_str_arg('T', "timeout", "with -s, end a session whose client sends nothing for N seconds, which its -c reports as an error (not with -z, whose sessions wait for the next document)", "N");
+  cli.add_str_arg('c', "client", "process the input with the server at SOCKET, which has the rules (so fst_file is not given)", "SOCKET");
   cli.add_bool_arg('h', "help", "print this message and exit");
-  cli.add_file_arg("fst_file", false);
+  cli.add_file_arg("fst_file", true);
   cli.add_file_arg("input_file", true);
   cli.add_file_arg("output_file", true);
   cli.parse_args(argc, argv);
 
-  LRXProcessor lrxp;
+  for (auto& socket : cli.get_strs()["client"]) {
+    // the files are those of the input and output
+    auto& files = cli.get_files();
+    if (!files[2].empty()) {
+      cli.print_usage();
+      exit(EXIT_FAILURE);
+    }
+    int input = 0;
+    if (!files[0].empty()) {
+      input = open(files[0].c_str(), O_RDONLY);
+      if (input < 0) {
+        cerr << "Error: Unable to open '" << files[0] << "' for reading." << endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+    int output = 1;
+    if (!files[1].empty()) {
+      output = open(files[1].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      if (output < 0) {
+        cerr << "Error: Unable to open '" << files[1] << "' for writing." << endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+    if (!LRXServer::client(socket.c_str(), input, output)) {
+      cerr << "Error: Unable to connect to '" << socket << "'." << endl;
+      exit(EXIT_FAILURE);
+    }
+    return EXIT_SUCCESS;
+  }
+  if (cli.get_files()[0].empty()) {
+    cli.print_usage();
+    exit(EXIT_FAILURE);
+  }
 
-  lrxp.setNullFlush(cli.get_bools()["null-flush"]);
-  lrxp.setTraceMode(cli.get_bools()["trace"]);
-  lrxp.setDebugMode(cli.get_bools()["debug"]);
+  auto lrxp = make_shared<LRXProcessor>();
+
+  lrxp->setLoadDebug(cli.get_bools()["debug"]);
+  for (auto& engine : cli.get_strs()["engine"]) {
+    if (engine == "nfa") {
+      lrxp->setEngine(LRXMatcher::NFA);
+    } else if (engine == "dfa") {
+      lrxp->setEngine(LRXMatcher::LazyDFA);
+    } else {
+      cerr << "Unknown engine '" << engine << "', expected nfa or dfa" << endl;
+      cli.print_usage();
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (auto& arg : cli.get_strs()["max-alive"]) {
+    char* end;
+    long long n = strtoll(arg.c_str(), &end, 10);
+    if (*end != '\0' || n < 1) {
+      cerr << "Invalid number of paths '" << arg << "'" << endl;
+      cli.print_usage();
+      exit(EXIT_FAILURE);
+    }
+    lrxp->setBeam(n);
+  }
+  lrxp->setVerify(cli.get_bools()["verify"]);
 
   FILE* in = openInBinFile(cli.get_files()[0]);
-  lrxp.load(in);
+  lrxp->load(in);
   fclose(in);
+  lrxp->init();
 
-  InputFile input;
+  LRXModel model(lrxp);
+  LRXSession session(model);
+  session.setNullFlush(cli.get_bools()["null-flush"]);
+  session.setTraceMode(cli.get_bools()["trace"]);
+  session.setDebugMode(cli.get_bools()["debug"]);
+
+  unsigned int jobs = 1;
+  for (auto& arg : cli.get_strs()["jobs"]) {
+    char* end;
+    long n = strtol(arg.c_str(), &end, 10);
+    if (*end != '\0' || n < 1) {
+      cerr << "Invalid number of jobs '" << arg << "'" << endl;
+      cli.print_usage();
+      exit(EXIT_FAILURE);
+    }
+    jobs = n;
+  }
+  size_t max_window[2] = {0, 0};
+  const char* window_args[2] = {"max-window", "max-window-bytes"};
+  for (int i = 0; i < 2; i++) {
+    for (auto& arg : cli.get_strs()[window_args[i]]) {
+      char* end;
+      long long n = strtoll(arg.c_str(), &end, 10);
+      if (*end != '\0' || n < 1) {
+        cerr << "Invalid window size '" << arg << "'" << endl;
+        cli.print_usage();
+        exit(EXIT_FAILURE);
+      }
+      max_window[i] = n;
+    }
+  }
+  session.setMaxWindow(max_window[0], max_window[1]);
+
+  bool blank_lines = cli.get_bools()["blank-lines"];
+  if (jobs > 1 && !blank_lines && !cli.get_bools()["null-flush"] &&
+      cli.get_strs()["server"].empty()) {
+    cerr << "WARNING: -j needs -z or -b to cut the input, using one thread" << endl;
+  }
+  unsigned int timeout = 0;
+  for (auto& arg : cli.get_strs()["timeout"]) {
+    char* end;
+    long n = strtol(arg.c_str(), &end, 10);
+    if (*end != '\0' || n < 1) {
+      cerr << "Invalid timeout '" << arg << "'" << endl;
+      cli.print_usage();
+      exit(EXIT_FAILURE);
+    }
+    if (cli.get_bools()["null-flush"]) {
+      cerr << "WARNING: -T is not used with -z, whose sessions may be idle between documents" << endl;
+    } else {
+      timeout = n;
+    }
+  }
+  for (auto& socket : cli.get_strs()["server"]) {
+    if (cli.get_strs()["jobs"].empty()) {
+      jobs = max(thread::hardware_concurrency(), 1u);
+    }
+    LRXServer(model.getProcessor(), session.getModes(), jobs, blank_lines,
+              timeout).serve(socket.c_str());
+  }
+  if (blank_lines || (jobs > 1 && cli.get_bools()["null-flush"])) {
+    FILE* input = stdin;
+    if (!cli.get_files()[1].empty()) {
+      input = fopen(cli.get_files()[1].c_str(), "rb");
+      if (input == nullptr) {
+        cerr << "Error: Unable to open '" << cli.get_files()[1] << "' for reading." << endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+    FILE* output = stdout;
+    if (!cli.get_files()[2].empty()) {
+      output = fopen(cli.get_files()[2].c_str(), "wb");
+      if (output == nullptr) {
+        cerr << "Error: Unable to open '" << cli.get_files()[2] << "' for writing." << endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+    LRXParallel(model.getProcessor(), session.getModes(), jobs,
+                blank_lines).process(input, output, cerr);
+    fclose(output);
+    return EXIT_SUCCESS;
+  }
+
+  LRXInput input;
   if (!cli.get_files()[1].empty()) {
     input.open_or_exit(cli.get_files()[1].c_str());
+  } else {
+    input.open();
   }
   UFILE* output = openOutTextFile(cli.get_files()[2]);
 
-  lrxp.init();
-  lrxp.process(input, output);
+  if (cli.get_bools()["pipeline"]) {
+    LRXPipeline(model.getProcessor(), session.getModes()).process(input, output);
+  } else {
+    session.process(input, output);
+  }
   u_fclose(output);
   return EXIT_SUCCESS;
 }
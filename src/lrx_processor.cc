@@ -17,9 +17,12 @@
 
 #include <weight.h>
 #include <lrx_processor.h>
+#include <lrx_records.h>
 #include <iostream>
 #include <algorithm>
+#include <cstring>
 #include <lttoolbox/compression.h>
+#include <unicode/utf8.h>
 
 using namespace std;
 
@@ -34,16 +37,7 @@ UString const LRXProcessor::LRX_PROCESSOR_TAG_ANY_LOWER      = "<ANY_LOWER>"_u;
 UString const LRXProcessor::LRX_PROCESSOR_TAG_WORD_BOUNDARY  = "<$>"_u;
 UString const LRXProcessor::LRX_PROCESSOR_TAG_NULL_BOUNDARY  = "<$$>"_u;
 
-UString
-LRXProcessor::itow(int i)
-{
-  // Convert an int to a UString
-  UChar buf[50];
-  u_snprintf(buf, 50, "%d", i);
-  UString id(buf);
-  return id;
-}
-
+size_t const LRXProcessor::LRX_PROCESSOR_MAX_TRANSLATIONS    = 1 << 16;
 
 LRXProcessor::LRXProcessor()
 {
@@ -54,82 +48,181 @@ LRXProcessor::~LRXProcessor()
 }
 
 void
-LRXProcessor::setTraceMode(bool m)
+LRXProcessor::setEngine(LRXMatcher::Engine e)
 {
-  traceMode = m;
+  matcher.setEngine(e);
 }
 
 void
-LRXProcessor::setNullFlush(bool m)
+LRXProcessor::setBeam(size_t max_alive)
 {
-  nullFlush = m;
+  beam = max_alive;
 }
 
 void
-LRXProcessor::setDebugMode(bool m)
+LRXProcessor::setVerify(bool value)
 {
-  debugMode = m;
+  verify = value;
+}
+
+void
+LRXProcessor::setLoadDebug(bool value)
+{
+  loadDebug = value;
 }
 
 void
 LRXProcessor::load(FILE *in)
 {
-  alphabet.read(in);
+  if(LRXFlatFile::isFlat(in))
+  {
+    loadFlat(in);
+  }
+  else
+  {
+    loadStream(in);
+  }
+
+  alternatives.init(any_char, any_tag, any_upper, any_lower);
+  skip_key = internKey(LRX_PROCESSOR_TAG_SKIP);
+  if(word_mode)
+  {
+    for(size_t i = 0; i < words.keyCount(); i++)
+    {
+      word_symbols.push_back(alphabet(words.key(i)));
+    }
+  }
+
+  if(loadDebug)
+  {
+    cerr << "recognisers: " << recogniser.keyCount() << " [states: " << recogniser.size() << "]" << endl;
+    if(word_mode)
+    {
+      cerr << "word classes: " << words.keyCount() << " [states: " << words.size() << "]" << endl;
+    }
+  }
+
+  // set up the engine once, rather than in every stream
+  matcher.setWordBoundary(word_boundary);
+  matcher.setBeam(beam, weights);
+  matcher.reset();
+}
+
+void
+LRXProcessor::readSymbols()
+{
   any_char      = alphabet(LRX_PROCESSOR_TAG_ANY_CHAR);
   any_tag       = alphabet(LRX_PROCESSOR_TAG_ANY_TAG);
   any_upper     = alphabet(LRX_PROCESSOR_TAG_ANY_UPPER);
   any_lower     = alphabet(LRX_PROCESSOR_TAG_ANY_LOWER);
   word_boundary = alphabet(LRX_PROCESSOR_TAG_WORD_BOUNDARY);
   null_boundary = alphabet(LRX_PROCESSOR_TAG_NULL_BOUNDARY);
+}
 
-  int len = Compression::multibyte_read(in);
+void
+LRXProcessor::loadFlat(FILE *in)
+{
+  LRXFlatFile file;
+  file.read(in);
+  if(verify)
+  {
+    file.verify();
+  }
+
+  LRXFlatReader section = file.section(LRX_FLAT_ALPHABET);
+  for(auto& symbol : section.strings())
+  {
+    alphabet.includeSymbol(symbol);
+  }
+  readSymbols();
 
+  section = file.section(LRX_FLAT_RECOGNISER);
+  recogniser.read(section);
+  if(file.has(LRX_FLAT_WORDS))
+  {
+    section = file.section(LRX_FLAT_WORDS);
+    words.read(section);
+    word_mode = true;
+  }
+  if(file.has(LRX_FLAT_ANCHORS))
+  {
+    section = file.section(LRX_FLAT_ANCHORS);
+    anchors.read(section, alphabet);
+  }
+  section = file.section(LRX_FLAT_MATCHER);
+  matcher.read(section);
+  section = file.section(LRX_FLAT_WEIGHTS);
+  weights = section.array<double>();
+  if(file.has(LRX_FLAT_AFFIXES))
+  {
+    section = file.section(LRX_FLAT_AFFIXES);
+    affixes.read(section);
+  }
+}
+
+void
+LRXProcessor::loadStream(FILE *in)
+{
+  alphabet.read(in);
+  readSymbols();
+
+  // Binaries from older versions of lrx-comp have one recogniser per key
+  // here; they are combined into a single automaton at load time
+  int len = Compression::multibyte_read(in);
+  vector<UString> names;
+  vector<Transducer> legacy(len);
   while(len > 0)
   {
     UString name = Compression::string_read(in);
-    recognisers[name].read(in, alphabet);
-    if(debugMode)
+    Transducer& rec = legacy[names.size()];
+    rec.read(in);
+    names.push_back(name);
+    if(loadDebug)
     {
-      cerr << "Recogniser: " << name << ", [finals: " << recognisers[name].getFinals().size() << "]\n";
+      cerr << "Recogniser: " << name << ", [finals: " << rec.getFinals().size() << "]\n";
     }
     len--;
   }
 
-  if(debugMode)
+  vector<Transducer *> recs;
+  for(auto& rec : legacy)
   {
-    cerr << "recognisers: " << recognisers.size() << endl;
+    recs.push_back(&rec);
   }
+  recogniser.build(names, recs, alphabet);
 
-  UString name = Compression::string_read(in);
-
-  transducer.read(in, alphabet);
+  Compression::string_read(in); // the name of the main transducer
+  matcher.read(in, alphabet);
 
   // Now read in weights
+  vector<double> rule_weights;
   weight record;
   while(fread(&record, sizeof(weight), 1, in))
   {
     weight_from_le(record);
-    UString sid = "<"_u + itow(record.id) + ">"_u;
-    weights[sid] = record.pisu;
+    if(record.id < 0)
+    {
+      continue;
+    }
+    if(static_cast<size_t>(record.id) >= rule_weights.size())
+    {
+      rule_weights.resize(record.id + 1, 0.0);
+    }
+    rule_weights[record.id] = record.pisu;
 
     /*
-    if(debugMode)
+    if(loadDebug)
     {
-      cerr << sid << " " << record.id << " weight(" << record.pisu << ")\n";
+      cerr << record.id << " weight(" << record.pisu << ")\n";
     }
     */
   }
-
-  return;
+  weights = std::move(rule_weights);
 }
 
 void
 LRXProcessor::init()
 {
-  initial_state.init(transducer.getInitial());
-
-  anfinals.insert(transducer.getFinals().begin(), transducer.getFinals().end());
-
   escaped_chars.insert('[');
   escaped_chars.insert(']');
   escaped_chars.insert('{');
@@ -144,267 +237,769 @@ LRXProcessor::init()
 
 }
 
-void
-LRXProcessor::make_anys(int32_t sym, std::set<int32_t>& alts)
-{
-  if (sym <= 0) {
-    alts.insert(any_tag);
-  } else {
-    alts.insert(any_char);
-    if (u_isupper(sym)) {
-      alts.insert(u_tolower(sym));
-      alts.insert(any_upper);
-    } else {
-      alts.insert(any_lower);
+LRXWindow::OpType
+LRXProcessor::opType(const UString& key)
+{
+  if(key.size() > 1 && key[0] == '<' && key[1] == 'r')
+  {
+    return LRXWindow::Remove;
+  }
+  return LRXWindow::Select;
+}
+
+int32_t
+LRXProcessor::internKey(const UString& key)
+{
+  int32_t id = recogniser.findKey(key);
+  if(id >= 0)
+  {
+    return id;
+  }
+  auto it = op_ids.find(key);
+  if(it != op_ids.end())
+  {
+    return it->second;
+  }
+  id = recogniser.keyCount() + op_keys.size();
+  op_ids[key] = id;
+  op_keys.push_back(key);
+  return id;
+}
+
+int32_t
+LRXProcessor::opId(Stream &s, const UString& key) const
+{
+  auto it = s.op_ids.find(key);
+  if(it != s.op_ids.end())
+  {
+    return it->second;
+  }
+  int32_t id = recogniser.findKey(key);
+  if(id < 0)
+  {
+    auto found = op_ids.find(key);
+    if(found != op_ids.end())
+    {
+      id = found->second;
+    }
+    else
+    {
+      id = recogniser.keyCount() + op_keys.size() + s.op_keys.size();
+      s.op_keys.push_back(key);
     }
   }
+  s.op_ids[key] = id;
+  return id;
+}
+
+UString
+LRXProcessor::opKey(const Stream &s, int32_t id) const
+{
+  return UString(opKeyView(s, id));
+}
+
+UStringView
+LRXProcessor::opKeyView(const Stream &s, int32_t id) const
+{
+  size_t i = id;
+  if(i < recogniser.keyCount())
+  {
+    return recogniser.keyView(id);
+  }
+  i -= recogniser.keyCount();
+  if(i < op_keys.size())
+  {
+    return op_keys[i];
+  }
+  return s.op_keys[i - op_keys.size()];
+}
+
+uint32_t
+LRXProcessor::segment(Stream &s, const int32_t *syms, size_t count) const
+{
+  // FNV-1a over the symbols
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for(size_t i = 0; i < count; i++)
+  {
+    hash = (hash ^ static_cast<uint32_t>(syms[i])) * 0x100000001b3ULL;
+  }
+  auto range = s.segment_ids.equal_range(hash);
+  for(auto it = range.first; it != range.second; it++)
+  {
+    const Stream::Segment& seg = s.segment_list[it->second];
+    if(seg.length == count &&
+       equal(syms, syms + count, s.segment_symbols.begin() + seg.offset))
+    {
+      return it->second;
+    }
+  }
+
+  // first met: find its op key as the string it spells
+  UString key;
+  for(size_t i = 0; i < count; i++)
+  {
+    if(escaped_chars.find(syms[i]) != escaped_chars.end())
+    {
+      key += '\\';
+    }
+    alphabet.getSymbol(key, syms[i]);
+  }
+  Stream::Segment seg;
+  seg.offset = s.segment_symbols.size();
+  seg.length = count;
+  seg.key = opId(s, key);
+  seg.op = opType(key);
+  s.segment_symbols.insert(s.segment_symbols.end(), syms, syms + count);
+  uint32_t id = s.segment_list.size();
+  s.segment_list.push_back(seg);
+  s.segment_ids.insert(make_pair(hash, id));
+  return id;
+}
+
+static int
+digits(int64_t n)
+{
+  int count = 1;
+  for(; n >= 10; n /= 10)
+  {
+    count++;
+  }
+  return count;
 }
 
 bool
-LRXProcessor::recognisePattern(const UString& lu, const UString& op)
+LRXProcessor::ruleBefore(int32_t a, int32_t b)
 {
-  if(recognisers.count(op) < 1)
+  // as "<a>" and "<b>" compare: by digits, with a prefix after what it
+  // prefixes
+  if((a < 0) != (b < 0))
+  {
+    return a < 0;
+  }
+  int64_t x = a < 0 ? -static_cast<int64_t>(a) : a;
+  int64_t y = b < 0 ? -static_cast<int64_t>(b) : b;
+  int dx = digits(x);
+  int dy = digits(y);
+  for(int i = dx; i > dy; i--)
   {
-    cerr << "WARNING: Recogniser not found for key " << op << ", skipping... [LU: " << lu << "]" << endl;
-    return false;
+    x /= 10;
   }
+  for(int i = dy; i > dx; i--)
+  {
+    y /= 10;
+  }
+  if(x != y)
+  {
+    return x < y;
+  }
+  return dx > dy;
+}
 
-  State cur;
-  cur.init(recognisers[op].getInitial());
+bool
+LRXProcessor::matchBefore(const Stream &s, const LRXMatcher::Match &a,
+                          const LRXMatcher::Match &b) const
+{
+  if(a.rule != b.rule)
+  {
+    return ruleBefore(a.rule, b.rule);
+  }
+  // as their op keys compare as strings
+  for(uint32_t i = a.begin, j = b.begin; i < a.end || j < b.end; i++, j++)
+  {
+    if(i == a.end || j == b.end)
+    {
+      return i == a.end;
+    }
+    int32_t x = s.segment_list[s.match_entries[i]].key;
+    int32_t y = s.segment_list[s.match_entries[j]].key;
+    if(x != y)
+    {
+      return opKeyView(s, x) < opKeyView(s, y);
+    }
+  }
+  return false;
+}
+
+double
+LRXProcessor::ruleWeight(int32_t id) const
+{
+  if(id < 0 || static_cast<size_t>(id) >= weights.size())
+  {
+    return 0.0;
+  }
+  return weights[id];
+}
+
+int32_t
+LRXProcessor::translationId(Stream &s, const char *lu, size_t length) const
+{
+  s.key.assign(lu, length);
+  auto it = s.translation_ids.find(s.key);
+  if(it != s.translation_ids.end())
+  {
+    s.cache_hits++;
+    return it->second;
+  }
+  s.cache_misses++;
+  if(s.translation_keys.size() >= LRX_PROCESSOR_MAX_TRANSLATIONS)
+  {
+    s.translation_ids.clear();
+    s.translation_keys.clear();
+  }
+  int32_t id = s.translation_keys.size();
+  s.translation_ids[s.key] = id;
+  s.translation_keys.emplace_back();
+  tokenize(s, lu, length, s.lu_syms);
+  recogniser.match(s.lu_syms, alternatives, s.translation_keys.back());
+  return id;
+}
+
+int32_t
+LRXProcessor::wordClasses(Stream &s, const char *lu, size_t length) const
+{
+  s.key.assign(lu, length);
+  auto it = s.word_ids.find(s.key);
+  if(it != s.word_ids.end())
+  {
+    s.cache_hits++;
+    return it->second;
+  }
+  s.cache_misses++;
+  if(s.word_ids.size() >= LRX_PROCESSOR_MAX_TRANSLATIONS)
+  {
+    s.word_ids.clear();
+  }
+  tokenize(s, lu, length, s.lu_syms);
+  words.match(s.lu_syms, alternatives, s.classes);
+  for(auto& key : s.classes)
+  {
+    key = word_symbols[key];
+  }
+  sort(s.classes.begin(), s.classes.end());
+  int32_t id = s.matcher.classSet(s.classes);
+  s.word_ids[s.key] = id;
+  return id;
+}
 
-  auto syms = alphabet.tokenize(lu);
-  for (auto& sym : syms) {
-    if(cur.size() < 1)  // I think that any time we have 0 alive states,
-                        // we can say that the string is unrecognised
+void
+LRXProcessor::tokenize(Stream &s, const char *text, size_t length,
+                       vector<int32_t> &syms) const
+{
+  syms.clear();
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(text);
+  int32_t n = static_cast<int32_t>(length);
+  int32_t i = 0;
+  while(i < n)
+  {
+    // ASCII is its own symbol, and is all a tag is looked for by
+    UChar32 c = p[i];
+    if(c < 0x80)
+    {
+      i++;
+    }
+    else
     {
-      return false;
+      U8_NEXT(p, i, n, c);
+    }
+    if(c == '\\')
+    {
+      if(i < n)
+      {
+        U8_NEXT(p, i, n, c);
+      }
+      syms.push_back(c);
+    }
+    else if(c == '<')
+    {
+      const void *gt = memchr(p + i, '>', n - i);
+      int32_t j = (gt == nullptr ? n : static_cast<const uint8_t *>(gt) - p);
+      syms.push_back(tagSymbol(s, text + i - 1, min(j + 1, n) - (i - 1)));
+      i = j + 1;
+    }
+    else
+    {
+      syms.push_back(c);
     }
-    std::set<int32_t> alts;
-    make_anys(sym, alts);
-    cur.step((sym == 0 ? any_tag : sym), alts);
   }
+}
 
-  return cur.isFinal(recognisers[op].getFinals());
+int32_t
+LRXProcessor::tagSymbol(Stream &s, const char *tag, size_t length) const
+{
+  s.tag.assign(tag, length);
+  auto it = s.tag_ids.find(s.tag);
+  if(it != s.tag_ids.end())
+  {
+    return it->second;
+  }
+  if(s.tag_ids.size() >= LRX_PROCESSOR_MAX_TRANSLATIONS)
+  {
+    s.tag_ids.clear();
+  }
+  UString name;
+  LRXWindow::decode(tag, length, name);
+  int32_t sym = alphabet(name);
+  s.tag_ids[s.tag] = sym;
+  return sym;
+}
+
+bool
+LRXProcessor::recognisePattern(Stream &s, int32_t translation, int32_t rec) const
+{
+  if(s.modes.debugMode)
+  {
+    s.used_keys.insert(rec);
+  }
+  const vector<int32_t>& keys = s.translation_keys[translation];
+  return binary_search(keys.begin(), keys.end(), rec);
 }
 
 void
-LRXProcessor::read_seg(InputFile& input, UString& seg)
+LRXProcessor::read_seg(InputFile& input, string& seg) const
 {
   bool escaped = false;
   while (!input.eof()) {
     UChar32 c = input.get();
     if (escaped) {
-      seg += c;
+      LRXWindow::append(seg, c);
       escaped = false;
     } else if (c == '\\') {
-      seg += c;
+      LRXWindow::append(seg, c);
       escaped = true;
     } else if (c == '<') {
-      seg += input.readBlock('<', '>');
+      UString tag = input.readBlock('<', '>');
+      for (int32_t i = 0, n = tag.size(); i < n; ) {
+        UChar32 t;
+        U16_NEXT(tag.data(), i, n, t);
+        LRXWindow::append(seg, t);
+      }
     } else if (c == '/' || c == '$') {
       input.unget(c);
       break;
     } else {
-      seg += c;
+      LRXWindow::append(seg, c);
     }
   }
 }
 
 void
-LRXProcessor::process(InputFile& input, UFILE *output)
+LRXProcessor::read_seg(LRXInput& input, string& seg) const
+{
+  input.readSegment(seg);
+}
+
+void
+LRXProcessor::read_seg(LRXRecords& input, string& seg) const
+{
+  input.readSegment(seg);
+}
+
+size_t
+LRXProcessor::read_blank(InputFile& input, string& blank) const
+{
+  return 0;
+}
+
+size_t
+LRXProcessor::read_blank(LRXInput& input, string& blank) const
+{
+  return input.readBlank(blank);
+}
+
+size_t
+LRXProcessor::read_blank(LRXRecords& input, string& blank) const
+{
+  return input.readBlank(blank);
+}
+
+bool
+LRXProcessor::read_blank_ref(InputFile& input, UChar32 c, const char *&text,
+                             size_t &length, size_t &newlines) const
+{
+  return false;
+}
+
+bool
+LRXProcessor::read_blank_ref(LRXInput& input, UChar32 c, const char *&text,
+                             size_t &length, size_t &newlines) const
+{
+  return input.readBlankInPlace(c, text, length, newlines);
+}
+
+bool
+LRXProcessor::read_blank_ref(LRXRecords& input, UChar32 c, const char *&text,
+                             size_t &length, size_t &newlines) const
+{
+  return input.readBlankInPlace(c, text, length, newlines);
+}
+
+void
+LRXProcessor::tie(InputFile& input, LRXOutput *output) const
+{
+}
+
+void
+LRXProcessor::tie(LRXInput& input, LRXOutput *output) const
+{
+  input.tie(output);
+}
+
+void
+LRXProcessor::tie(LRXRecords& input, LRXOutput *output) const
+{
+  input.tie(output);
+}
+
+void
+LRXProcessor::initStream(Stream &s, Modes modes, ostream &log) const
+{
+  s = Stream();
+  s.matcher = matcher;
+  s.log = &log;
+  s.modes = modes;
+}
+
+void
+LRXProcessor::process(Stream &s, InputFile& input, UFILE *output) const
+{
+  processOutput(s, input, output);
+}
+
+void
+LRXProcessor::process(Stream &s, LRXInput& input, UFILE *output) const
+{
+  processOutput(s, input, output);
+}
+
+template<class Input>
+void
+LRXProcessor::processOutput(Stream &s, Input& input, UFILE *output) const
+{
+  u_fflush(output);
+  FILE *file = u_fgetfile(output);
+  if(file != nullptr)
+  {
+    s.output.open(file);
+    processStream(s, input);
+    return;
+  }
+  char *buffer = nullptr;
+  size_t size = 0;
+  FILE *mem = open_memstream(&buffer, &size);
+  s.output.open(mem);
+  processStream(s, input);
+  fclose(mem);
+  UString text;
+  LRXWindow::decode(buffer, size, text);
+  u_file_write(text.data(), text.size(), output);
+  free(buffer);
+}
+
+void
+LRXProcessor::process(Stream &s, LRXRecords& input) const
 {
-  map<int, UString > sl; // map of SL words
-  map<int, vector<UString> > tl; // map of vectors of TL translations
-  map<int, UString > blanks; // map of the superblanks
+  processStream(s, input);
+}
 
-  map<int, map<UString, double> > scores; //
-  map<int, map<UString, OpType> > operations;
+template<class Input>
+void
+LRXProcessor::processStream(Stream &s, Input& input) const
+{
+  LRXWindow window; // SL words, TL translations, superblanks and scores
+  LRXOutput& output = s.output;
 
-  State s = initial_state;
+  s.pos = 0;
+  s.emitted = 0;
+  s.matcher.reset();
   if (null_boundary) {
-    s.step_optional(null_boundary);
+    s.matcher.stepOptional(null_boundary);
+  }
+  // whether only the initial state is alive, as after a flush
+  bool idle = false;
+  // with -z, the words done are given to the reader before the input is
+  // waited on, not only at the next NUL
+  if(s.modes.nullFlush)
+  {
+    tie(input, &output);
   }
 
   int32_t val = 0;
   while((val = input.get()) != U_EOF)
   {
 
-    if(nullFlush && val == '\0')
+    if(s.modes.nullFlush && val == '\0')
     {
-      processFlush(output, sl, tl, blanks, scores, operations);
-      u_fprintf(output, "%S", blanks[pos].c_str());
-      pos = 0;
-      tl.clear();
-      sl.clear();
-      blanks.clear();
-      scores.clear();
-      operations.clear();
-      s = initial_state;
+      processFlush(s, output, window, s.pos + 1);
+      window.write(window.at(s.pos).blank, output);
+      s.pos = 0;
+      s.emitted = 0;
+      window.clear();
+      s.matcher.reset();
       if (null_boundary) {
-        s.step_optional(null_boundary);
+        s.matcher.stepOptional(null_boundary);
       }
+      idle = false;
 
-      u_fputc(val, output);
-      u_fflush(output);
+      output.put('\0');
+      output.sync();
       continue;
     }
 
     // We're starting to read a new lexical form
     if(val == '^') {
-      if (debugMode) {
-        cerr << "outOfWord = false\n";
+      if (s.modes.debugMode) {
+        *s.log << "outOfWord = false\n";
       }
-      read_seg(input, sl[pos]);
-      if (debugMode) {
-        cerr << "  read sl: " << sl[pos] << std::endl;
+      size_t start = window.mark();
+      read_seg(input, window.buffer());
+      window.setSL(s.pos, window.spanFrom(start));
+      LRXWindow::Token& tok = window.at(s.pos);
+      if (s.modes.debugMode) {
+        window.copy(tok.sl, s.scratch);
+        *s.log << "  read sl: " << s.scratch << std::endl;
       }
       bool unknown = false;
-      if (!sl[pos].empty() && sl[pos][0] == '*') {
+      if (window.first(tok.sl) == '*') {
         unknown = true;
-        if (debugMode) {
-          cerr << "  skipping unknown marker" << endl;
+        if (s.modes.debugMode) {
+          *s.log << "  skipping unknown marker" << endl;
         }
       }
       while (input.peek() == '/') {
         input.get();
-        UString trad;
-        read_seg(input, trad);
-        tl[pos].push_back(trad);
+        start = window.mark();
+        read_seg(input, window.buffer());
+        window.addTL(s.pos, window.spanFrom(start));
       }
       input.get();
-      if(debugMode) {
-        for(auto& it : tl[pos]) {
-          cerr << "trad[" << pos << "]: " << it << endl;
+      if(s.modes.debugMode) {
+        for(size_t i = 0; i < tok.tl_count; i++) {
+          window.copy(window.tl(tok, i), s.scratch);
+          *s.log << "trad[" << s.pos << "]: " << s.scratch << endl;
         }
       }
 
-      auto syms = alphabet.tokenize(unknown ? sl[pos].substr(1): sl[pos]);
-      for (auto& sym : syms) {
-        std::set<int32_t> alts;
-        make_anys(sym, alts);
-        s.step((sym == 0 ? any_tag : sym), alts);
-        if (debugMode) {
-          UString res;
-          alphabet.getSymbol(res, sym, false);
-          cerr << "  step: " << res << " [alts: " << alts.size() << "]\n";
+      // the unknown marker is one byte
+      const char *sl = window.data(tok.sl) + (unknown ? 1 : 0);
+      size_t sl_length = tok.sl.length - (unknown ? 1 : 0);
+      bool dead = false;
+      if (word_mode) {
+        // one step over all the word classes of the SL word
+        int32_t set = wordClasses(s, sl, sl_length);
+        s.matcher.stepClasses(set);
+        if (s.modes.debugMode) {
+          *s.log << "  step: class set " << set << "\n";
+        }
+      } else {
+        vector<int32_t>& syms = s.syms;
+        tokenize(s, sl, sl_length, syms);
+        // a word that cannot start a rule would leave nothing alive
+        dead = idle && !anchors.canStart(syms, s.anchor_key);
+        if (dead) {
+          syms.clear();
+          s.anchor_skips++;
+        }
+        if (!affixes.empty()) {
+          // the literals found in the lemma, what comes before the first tag
+          size_t lemma = find_if(syms.begin(), syms.end(), [](int32_t sym) { return sym <= 0; }) - syms.begin();
+          affixes.match(syms.data(), lemma, alternatives, s.affix_symbols);
+          if (!s.affix_symbols.empty()) {
+            int32_t set = s.matcher.classSet(s.affix_symbols);
+            s.matcher.stepOptionalClasses(set);
+            if (s.modes.debugMode) {
+              *s.log << "  step:";
+              for (auto& sym : s.affix_symbols) {
+                UString res;
+                alphabet.getSymbol(res, sym, false);
+                *s.log << " " << res;
+              }
+              *s.log << " [optional]\n";
+            }
+          }
+        }
+        int32_t alts[LRXAlternatives::MAX];
+        for (auto& sym : syms) {
+          size_t n = alternatives.get(sym, alts);
+          s.matcher.step(alts, n);
+          if (s.modes.debugMode) {
+            UString res;
+            alphabet.getSymbol(res, sym, false);
+            *s.log << "  step: " << res << " [alts: " << n << "]\n";
+          }
         }
       }
 
-      if(debugMode) {
-        cerr << "[POS] " << pos << ": [sl " << sl[pos].size() << " ; tl " << tl[pos].size() << " ; bl " << blanks[pos].size() << "]: " << sl[pos] << endl;
+      if(s.modes.debugMode) {
+        window.copy(tok.sl, s.scratch);
+        *s.log << "[POS] " << s.pos << ": [sl " << window.units(tok.sl) << " ; tl " << tok.tl_count << " ; bl " << window.units(tok.blank) << "]: " << s.scratch << endl;
       }
+      if (!dead)
       {
         // \forall s \in A
-        sorted_vector<UString> seen_ids;
+        if(++s.epoch == 0)
+        {
+          fill(s.rule_epochs.begin(), s.rule_epochs.end(), 0);
+          s.epoch = 1;
+        }
+        s.seen_rules.clear();
         {
           // \IF \exists c \in Q : \delta(s, sent[i]) = c
-          s.step(word_boundary);
+          s.matcher.step(word_boundary);
 
           // A \gets A \cup {c}
-          s.step_optional(word_boundary);
+          s.matcher.stepOptional(word_boundary);
 
           // \IF c \in F
-          if (s.isFinal(anfinals))
+          if (s.matcher.isFinal())
           {
             // We've reached a final state, so we need to evaluate the rule we've matched
-            if (debugMode)
+            if (s.modes.debugMode)
             {
-              UString out = s.filterFinals(anfinals, alphabet, escaped_chars);
-              cerr << "    filter_finals: " << out << endl;
+              UString out;
+              s.matcher.filterFinals(alphabet, escaped_chars, out);
+              *s.log << "    filter_finals: " << out << endl;
             }
 
-            set<pair<UString, vector<UString>>> outpaths;
-            outpaths = s.filterFinalsLRX(anfinals, alphabet, escaped_chars, false, false, 0);
+            s.matcher.finalMatches(word_boundary, s.matches,
+                                   s.match_segments, s.match_symbols);
+            if(s.segment_list.size() >= LRX_PROCESSOR_MAX_TRANSLATIONS)
+            {
+              s.segment_ids.clear();
+              s.segment_list.clear();
+              s.segment_symbols.clear();
+            }
+            s.match_entries.clear();
+            for (auto& seg : s.match_segments)
+            {
+              s.match_entries.push_back(segment(s, &s.match_symbols[seg.first],
+                                                seg.second - seg.first));
+            }
+            s.match_order.clear();
+            for (uint32_t m = 0; m < s.matches.size(); m++)
+            {
+              s.match_order.push_back(m);
+            }
+            if (s.match_order.size() > 1)
+            {
+              sort(s.match_order.begin(), s.match_order.end(),
+                   [&](uint32_t x, uint32_t y) { return matchBefore(s, s.matches[x], s.matches[y]); });
+            }
 
-            for (auto& it : outpaths)
+            for (auto& m : s.match_order)
             {
-              const vector<UString>& path = it.second;
-              const UString& id = it.first;
+              const LRXMatcher::Match& match = s.matches[m];
+              int32_t id = match.rule;
 
-              if (seen_ids.find(id) != seen_ids.end())
+              size_t slot = id + 1;
+              if (slot >= s.rule_epochs.size())
+              {
+                s.rule_epochs.resize(slot + 1, 0);
+              }
+              if (s.rule_epochs[slot] == s.epoch)
               {
                 continue;
               }
-              seen_ids.insert(id);
+              s.rule_epochs[slot] = s.epoch;
+              if (s.modes.debugMode)
+              {
+                s.seen_rules.push_back(id);
+              }
 
-              int j = pos - (path.size() - 1);
+              int j = s.pos - (static_cast<int>(match.end - match.begin) - 1);
+              double weight = ruleWeight(id);
 
-              if (debugMode)
+              if (s.modes.debugMode)
               {
-                cerr << "id:      " << id << ": (lambda: ";
-                cerr << weights[id] << ")\n";
+                *s.log << "id:      <" << id << ">: (lambda: ";
+                *s.log << weight << ")\n";
               }
-              for (auto& it2 : path)
+              for (uint32_t i = match.begin; i < match.end; i++)
               {
-                if (debugMode)
+                const Stream::Segment& seg = s.segment_list[s.match_entries[i]];
+                if (s.modes.debugMode)
                 {
-                  cerr << "op:        " << it2 << endl;
+                  *s.log << "op:        " << opKey(s, seg.key) << endl;
                 }
-                if (it2 != LRX_PROCESSOR_TAG_SKIP)
+                // ops before the start of the window (the <$$> of a
+                // <begin/>) are never flushed, so they aren't stored
+                int32_t key = (j >= 0 ? seg.key : skip_key);
+                if (key != skip_key)
                 {
-                  if (scores[j].count(it2) == 0)
+                  LRXWindow::Score& sc = window.score(j, key);
+                  sc.weight += weight;
+                  if (s.modes.debugMode)
                   {
-                    scores[j][it2] = 0.0;
-                  }
-                  scores[j][it2] += weights[id.c_str()];
-                  if (debugMode)
-                  {
-                    cerr << "#[" << j << "]SCORE " << scores[j][it2] << " / ";
-                    cerr << it2 << endl;
-                  }
-                  if(it2.at(0) == '<' && it2.at(1) == 'r') {
-                    operations[j][it2] = Remove;
-                  }
-                  else {
-                    operations[j][it2] = Select;
+                    *s.log << "#[" << j << "]SCORE " << sc.weight << " / ";
+                    *s.log << opKey(s, seg.key) << endl;
                   }
+                  sc.op = seg.op;
                 }
                 j++;
               }
-              // cerr << "#SPAN[" << (pos-path.size()) << ", " << pos << "]\n";
             }
           }
         }
 
-        if (debugMode)
+        if (s.modes.debugMode)
         {
-          cerr << "seen:";
-          for (auto& it : seen_ids) {
-            cerr << " " << it << " ";
+          *s.log << "seen:";
+          sort(s.seen_rules.begin(), s.seen_rules.end(), ruleBefore);
+          for (auto& it : s.seen_rules) {
+            *s.log << " <" << it << "> ";
           }
-          cerr << endl;
-          cerr << "#CURRENT_ALIVE: " << s.size() << endl;
+          *s.log << endl;
+          *s.log << "#CURRENT_ALIVE: " << s.matcher.size() << endl;
         }
       }
 
-      if (s.size() == 0)
+      idle = (dead || s.matcher.size() == 0);
+      if (idle)
       {
         // If we have only a single alive state, it means no rules are
         // active, and we can flush the buffers.
 
-        if(debugMode)
+        if(s.modes.debugMode)
         {
-          cerr << "FLUSH:" << endl;
+          *s.log << "FLUSH:" << endl;
         }
 
 
         // Here we actually apply the rules that we've matched
-        processFlush(output, sl, tl, blanks, scores, operations);
-
-        pos = 0;
-        tl.clear();
-        sl.clear();
-        blanks.clear();
-        scores.clear();
-        //spans.clear();
+        processFlush(s, output, window, s.pos + 1);
+
+        s.pos = 0;
+        s.emitted = 0;
+        window.clear();
+      }
+      else
+      {
+        // The words no alive rule reaches back to are done, so they are
+        // written out as soon as that is cheap to see. Not with -t or -d,
+        // whose output gives the line number of, and comes in the order
+        // of, the flush of the whole window.
+        if(s.pos > s.emitted && !s.modes.traceMode && !s.modes.debugMode &&
+           s.matcher.synced())
+        {
+          int earliest = static_cast<int>(s.pos + 1) - static_cast<int>(s.matcher.reach());
+          if(earliest > static_cast<int>(s.emitted))
+          {
+            processFlush(s, output, window, earliest);
+          }
+        }
+        if(windowFull(s, window))
+        {
+          forceFlush(s, output, window);
+        }
       }
 
-      s.merge(initial_state);
+      if (!dead) {
+        s.matcher.mergeInitial();
+      }
 
-      pos++;
-      if(debugMode)
+      s.pos++;
+      if(s.modes.debugMode)
       {
-        cerr << "==> new pos: " << pos << endl;
+        *s.log << "==> new pos: " << s.pos << endl;
       }
 
       continue;
@@ -412,72 +1007,163 @@ LRXProcessor::process(InputFile& input, UFILE *output)
 
     // Reading a superblank
     if(!input.eof()) {
-      blanks[pos] += val;
+      const char *blank;
+      size_t length, newlines;
+      if(!s.modes.maxWindowBytes && window.empty(window.at(s.pos).blank) &&
+         read_blank_ref(input, val, blank, length, newlines))
+      {
+        // all of it, up to the next word or NUL, left where it was read
+        window.setBlank(s.pos, blank, length);
+        s.lineno += newlines;
+      }
+      else
+      {
+        window.appendBlank(s.pos, val);
+        if(s.modes.maxWindowBytes && window.bytes() > s.modes.maxWindowBytes)
+        {
+          forceFlush(s, output, window);
+        }
+        else if(!s.modes.maxWindowBytes)
+        {
+          // the rest of the blank, up to the next word or NUL
+          s.lineno += read_blank(input, window.buffer());
+          window.extendBlank(s.pos);
+        }
+      }
     }
 
     // Increment the current line number (for rule tracing)
     if(val == '\n')
     {
-      lineno++;
+      s.lineno++;
     }
 
   }
 
-  processFlush(output, sl, tl, blanks, scores, operations);
-  write(blanks[pos], output);
+  processFlush(s, output, window, s.pos + 1);
+  window.write(window.at(s.pos).blank, output);
+  output.flush();
+  tie(input, nullptr);
+
+  if(s.modes.debugMode)
+  {
+    *s.log << "recogniser cache: " << s.cache_hits << " hits, " << s.cache_misses << " misses" << endl;
+    *s.log << "anchors: " << s.anchor_skips << " words skipped" << endl;
+    *s.log << "recognisers: " << s.used_keys.size() << " of " << recogniser.keyCount() << " keys used" << endl;
+    *s.log << "window: " << s.forced_flushes << " forced flushes" << endl;
+    s.matcher.printStats(*s.log);
+  }
+}
+
+bool
+LRXProcessor::windowFull(const Stream &s, const LRXWindow &window) const
+{
+  return (s.modes.maxWindowTokens && s.pos + 1 >= s.modes.maxWindowTokens) ||
+         (s.modes.maxWindowBytes && window.bytes() > s.modes.maxWindowBytes);
+}
+
+void
+LRXProcessor::forceFlush(Stream &s, LRXOutput &output, LRXWindow &window) const
+{
+  if(s.modes.debugMode)
+  {
+    *s.log << "FORCED FLUSH:" << endl;
+  }
+  s.forced_flushes++;
+
+  // Only the oldest words go: those no alive rule reaches back to, then
+  // as many more as it takes to be back within the bounds. The rules
+  // still alive go on, and their ops land at positions counted back from
+  // the current one: on the words that went they are dropped, as for the
+  // words the window started after.
+  size_t count = s.pos + 1;
+  size_t reach = s.matcher.reach();
+  size_t drop = max<size_t>(count > reach ? count - reach : 0, s.emitted);
+  if(s.modes.maxWindowTokens && count - drop >= s.modes.maxWindowTokens)
+  {
+    drop = count + 1 - s.modes.maxWindowTokens;
+  }
+  if(s.modes.maxWindowBytes)
+  {
+    drop = max(drop, window.dropping(s.modes.maxWindowBytes));
+  }
+  if(drop < count)
+  {
+    processFlush(s, output, window, drop);
+    window.drop(drop);
+    s.pos -= drop;
+    s.emitted = 0;
+    return;
+  }
+
+  processFlush(s, output, window, s.pos + 1);
+  LRXWindow::Token& tok = window.at(s.pos);
+  if(window.empty(tok.sl))
+  {
+    // a superblank being read, which comes before the next word anyway
+    window.write(tok.blank, output);
+  }
+  s.pos = 0;
+  s.emitted = 0;
+  window.clear();
 }
 
 void
-LRXProcessor::processFlush(UFILE *output,
-                           map<int, UString > &sl,
-                           map<int, vector<UString> > &tl,
-                           map<int, UString > &blanks,
-                           map<int, map<UString, double> > &scores,
-                           map<int, map<UString, OpType> > &operations) {
-
-  struct ScoredMatch {
-      OpType op;
-      UString* ti;              // matched target translation
-      double weight;
-  };
+LRXProcessor::processFlush(Stream &s, LRXOutput &output, LRXWindow &window,
+                           unsigned int end) const {
+
+  auto& spos_matches = s.spos_matches;
+  auto& ti_keep = s.ti_keep;
+  auto& ti_removed = s.ti_removed;
 
   unsigned int spos = 0;
-  for(spos = 0; spos <= pos; spos++)
+  for(spos = s.emitted; spos < end; spos++)
   {
-    if(sl[spos].empty())
+    LRXWindow::Token& tok = window.at(spos);
+    if(window.empty(tok.sl))
     {
       continue;
     }
 
-    u_fprintf(output, "%S^%S/", blanks[spos].c_str(), sl[spos].c_str());
-
-    vector<UString>::iterator ti;
-    auto penum = tl[spos].end();
-    penum--;
+    window.write(tok.blank, output);
+    output.put('^');
+    window.write(tok.sl, output);
+    output.put('/');
 
-    if(tl[spos].size() > 1)
+    if(tok.tl_count > 1)
     {
       //--
-      set<UString*> ti_keep;
-      set<UString*> ti_removed;
-      vector<ScoredMatch> spos_matches;
-      for(ti = tl[spos].begin(); ti != tl[spos].end(); ti++)
+      size_t keep_count = tok.tl_count;
+      ti_keep.assign(tok.tl_count, true);
+      ti_removed.assign(tok.tl_count, false);
+      spos_matches.clear();
+      for(size_t ti = 0; ti < tok.tl_count; ti++)
       {
-        ti_keep.insert(&*ti);
-        for(const auto& si : scores[spos]) {
-          bool matched = recognisePattern(*ti, si.first);
-          OpType op = operations[spos][si.first];
-          if (debugMode) {
+        LRXWindow::Span tl = window.tl(tok, ti);
+        int32_t translation = translationId(s, window.data(tl), tl.length);
+        for(size_t si = 0; si < tok.score_count; si++) {
+          const LRXWindow::Score& sc = tok.scores[si];
+          bool matched = false;
+          if(static_cast<size_t>(sc.key) >= recogniser.keyCount())
+          {
+            window.copy(tl, s.scratch);
+            *s.log << "WARNING: Recogniser not found for key " << opKey(s, sc.key) << ", skipping... [LU: " << s.scratch << "]" << endl;
+          }
+          else
+          {
+            matched = recognisePattern(s, translation, sc.key);
+          }
+          if (s.modes.debugMode) {
             if (matched) {
-              cerr << "✔️ ";
+              *s.log << "✔️ ";
             } else {
-              cerr << "❎";
+              *s.log << "❎";
             }
-            cerr << " >>> " << spos << " -> ";
-            cerr << si.first << " -> " << si.second << endl;
+            *s.log << " >>> " << spos << " -> ";
+            *s.log << opKey(s, sc.key) << " -> " << sc.weight << endl;
           }
           if(matched) {
-            spos_matches.push_back({ op, &*ti, si.second });
+            spos_matches.push_back({ sc.op, ti, sc.weight });
           }
         }
       }
@@ -487,63 +1173,72 @@ LRXProcessor::processFlush(UFILE *output,
              spos_matches.end(),
              [](const auto &a, const auto &b) { return a.weight > b.weight; });
         for (const auto &m : spos_matches) {
-          if (traceMode || debugMode) {
-            std::string op = (m.op == Select ? "SELECT" : "REMOVE");
-            cerr << lineno << ":" << op << ":" << m.weight;
-            cerr << ":" << sl[spos] << ":" << ti_keep.size();
-            cerr << ":" << *m.ti << endl;
+          if (s.modes.traceMode || s.modes.debugMode) {
+            std::string op = (m.op == LRXWindow::Select ? "SELECT" : "REMOVE");
+            *s.log << s.lineno << ":" << op << ":" << m.weight;
+            window.copy(tok.sl, s.scratch);
+            *s.log << ":" << s.scratch << ":" << keep_count;
+            window.copy(window.tl(tok, m.ti), s.scratch);
+            *s.log << ":" << s.scratch << endl;
           }
           // We have to keep track of translations that have been removed so
           // that we don't end up adding back a translation that was removed.
-          if (m.op == Select && ti_removed.find(m.ti) == ti_removed.end()) {
-            ti_keep.clear();
-            ti_keep.insert(m.ti);
+          if (m.op == LRXWindow::Select && !ti_removed[m.ti]) {
+            ti_keep.assign(tok.tl_count, false);
+            ti_keep[m.ti] = true;
+            keep_count = 1;
             break;
-          } else if(ti_keep.size() > 1) {
-            ti_keep.erase(m.ti);
-            ti_removed.insert(m.ti);
+          } else if(keep_count > 1) {
+            if(ti_keep[m.ti]) {
+              ti_keep[m.ti] = false;
+              keep_count--;
+            }
+            ti_removed[m.ti] = true;
           }
         }
         bool printed = false;
-        for(const auto& ti_max : ti_keep) {
+        for(size_t ti = 0; ti < tok.tl_count; ti++) {
+          if(!ti_keep[ti]) {
+            continue;
+          }
           if(printed) {
-            u_fprintf(output, "/");
+            output.put('/');
           }
-          u_fprintf(output, "%S", ti_max->c_str());
+          window.write(window.tl(tok, ti), output);
           printed = true;
         }
       }
       else
       {
-        for(ti = tl[spos].begin(); ti != tl[spos].end(); ti++)
+        for(size_t ti = 0; ti < tok.tl_count; ti++)
         {
-          u_fprintf(output, "%S", ti->c_str());
-          if(ti != penum)
+          if(ti > 0)
           {
-            u_fprintf(output, "/");
+            output.put('/');
           }
+          window.write(window.tl(tok, ti), output);
         }
       }
     }
     else
     {
-      for(ti = tl[spos].begin(); ti != tl[spos].end(); ti++)
+      for(size_t ti = 0; ti < tok.tl_count; ti++)
       {
-        u_fprintf(output, "%S", ti->c_str());
-        if(ti != penum)
+        if(ti > 0)
         {
-          u_fputc('/', output);
+          output.put('/');
         }
+        window.write(window.tl(tok, ti), output);
       }
     }
 
-    u_fputc('$', output);
-    if(debugMode)
+    output.put('$');
+    if(s.modes.debugMode)
     {
-      u_fprintf(output, "%d", spos);
+      output.number(spos);
     }
 
 
   }
-
+  s.emitted = end;
 }
@@ -22,32 +22,172 @@
 #include <libgen.h>
 #include <set>
 #include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <libxml/xmlreader.h>
 
 #include <lttoolbox/alphabet.h>
-#include <lttoolbox/state.h>
-#include <lttoolbox/trans_exe.h>
 #include <lttoolbox/input_file.h>
 
+#include <lrx_affixes.h>
+#include <lrx_alternatives.h>
+#include <lrx_anchors.h>
+#include <lrx_flat.h>
+#include <lrx_input.h>
+#include <lrx_matcher.h>
+#include <lrx_output.h>
+#include <lrx_recogniser.h>
+#include <lrx_window.h>
+
 using namespace std;
 
+class LRXRecords;
+
 class LRXProcessor
 {
+public:
+  /**
+   * How a stream is processed, as lrx-proc's -t, -d, -z, -W and -B set it
+   */
+  struct Modes
+  {
+    bool traceMode = false;
+    bool debugMode = false;
+    bool nullFlush = false;
+
+    // The most tokens and text bytes the window may hold, or 0 for no
+    // limit; past them the window is flushed with the rules matched so
+    // far, although some are still alive
+    size_t maxWindowTokens = 0;
+    size_t maxWindowBytes = 0;
+  };
+
+  /**
+   * The state of one stream: the alive states of the rules, the position
+   * in the window, the memoised recogniser results, and whether and where
+   * the trace and debugging output go. The processor itself is only read while a
+   * stream is processed, so several streams can be processed at once,
+   * each with a Stream of its own.
+   */
+  struct Stream
+  {
+    LRXMatcher matcher;
+    ostream *log = nullptr;
+    Modes modes;
+    unsigned long forced_flushes = 0;
+
+    LRXOutput output;
+    unsigned int pos = 0;
+    unsigned int emitted = 0; // the positions before it have been written out
+    unsigned long lineno = 1; // Used for rule tracing
+    UString scratch; // reused whenever a window span is needed as a UString
+    string key;      // reused to look a window span up by its UTF-8
+    vector<int32_t> syms; // the symbols of the word being stepped
+    vector<int32_t> lu_syms; // those of a translation or word being recognised
+    vector<int32_t> affix_symbols; // those found in the current lemma
+
+    // the ids of the op keys met so far; those that were not known at
+    // load time are numbered after those
+    unordered_map<UString, int32_t> op_ids;
+    vector<UString> op_keys;
+    unordered_set<int32_t> used_keys; // recogniser keys checked, with -d
+
+    // The output segments (the ops of a rule path) met so far, with their
+    // op keys, looked up on their symbols so that no string is built once
+    // a segment has been seen; dropped when it grows past its bound
+    struct Segment
+    {
+      uint32_t offset; // its symbols in segment_symbols
+      uint32_t length;
+      int32_t key;
+      LRXWindow::OpType op;
+    };
+    unordered_multimap<uint64_t, uint32_t> segment_ids; // hash -> index
+    vector<Segment> segment_list;
+    vector<int32_t> segment_symbols;
+
+    // the matches at a final state, reused from one to the next
+    vector<LRXMatcher::Match> matches;
+    vector<pair<uint32_t, uint32_t>> match_segments;
+    vector<int32_t> match_symbols;
+    vector<uint32_t> match_entries; // the Segment of each of match_segments
+    vector<uint32_t> match_order;
+
+    // the ops matched on the translations of the word being written
+    // out, reused from one word to the next
+    struct ScoredMatch
+    {
+      LRXWindow::OpType op;
+      size_t ti; // index of the matched target translation
+      double weight;
+    };
+    vector<ScoredMatch> spos_matches;
+    vector<bool> ti_keep;
+    vector<bool> ti_removed;
+
+    // rules already scored at the current position have its epoch,
+    // indexed by rule id + 1
+    vector<uint32_t> rule_epochs;
+    uint32_t epoch = 0;
+    vector<int32_t> seen_rules; // with -d
+
+    // Memoised recogniser results: the ids of the keys matching each
+    // translation seen so far, in increasing order; dropped when it grows
+    // past its bound
+    unordered_map<string, int32_t> translation_ids; // by their UTF-8
+    vector<vector<int32_t>> translation_keys; // indexed by translation id
+    unsigned long cache_hits = 0;
+    unsigned long cache_misses = 0;
+
+    // The word class set of each SL word seen so far, with -w binaries
+    unordered_map<string, int32_t> word_ids;
+    vector<int32_t> classes;
+
+    // the symbols of the tags met so far, by their UTF-8
+    unordered_map<string, int32_t> tag_ids;
+    string tag;
+
+    UString anchor_key;
+    unsigned long anchor_skips = 0;
+  };
+
 private:
 
   Alphabet alphabet;
-  TransExe transducer;
-  map<UString, TransExe> recognisers;
-  map<UString, double> weights;
+  LRXMatcher matcher; // copied into each stream
+  LRXAlternatives alternatives;
+  LRXRecogniser recogniser;
 
-  map<Node *, double> anfinals;
-  set<UChar32> escaped_chars;
-  State initial_state;
+  // Op keys (the <select>/<remove> segments of the rule paths) have
+  // dense ids; below recogniser.keyCount() an op key id is the id of its
+  // recogniser key, looked up in the recogniser only when the key is
+  // first met, and the keys interned at load time follow
+  unordered_map<UString, int32_t> op_ids;
+  vector<UString> op_keys;            // indexed by op key id - recogniser.keyCount()
+  LRXFlatArray<double> weights;       // indexed by rule id
+  size_t beam = 0;                    // the most paths kept alive, 0 for no bound
+  bool verify = false;                // check a flat binary's checksum on load
+  bool loadDebug = false;             // print what is loaded to stderr
+  int32_t skip_key = -1;
 
-  bool traceMode = false;
-  bool debugMode = false;
-  bool nullFlush = false;
+  // Binaries compiled with lrx-comp -w match whole lexical units on word
+  // classes: the classes of each SL word, as a class set of the matcher,
+  // are memoised per stream like the translations
+  bool word_mode = false;
+  LRXRecogniser words;
+  vector<int32_t> word_symbols; // indexed by the words' key id
+
+  // Words that cannot start a rule are flushed without stepping while
+  // no rule is alive
+  LRXAnchors anchors;
+
+  // The suffix= and contains= literals, looked for in the lemma of each
+  // word stepped and taken as symbols of their own at its end
+  LRXAffixes affixes;
+
+  set<UChar32> escaped_chars;
 
   int32_t any_char;
   int32_t any_upper;
@@ -56,22 +196,83 @@ private:
   int32_t word_boundary;
   int32_t null_boundary;
 
-  unsigned int pos = 0;
-  unsigned long lineno = 1; // Used for rule tracing
+  void readSymbols();
+  void loadFlat(FILE *input);
+  void loadStream(FILE *input);
+
+  static LRXWindow::OpType opType(const UString& key);
+  int32_t internKey(const UString& key);
+  int32_t opId(Stream &s, const UString& key) const;
+  UString opKey(const Stream &s, int32_t id) const;
+  UStringView opKeyView(const Stream &s, int32_t id) const;
+  double ruleWeight(int32_t id) const;
+  uint32_t segment(Stream &s, const int32_t *syms, size_t count) const;
+  static bool ruleBefore(int32_t a, int32_t b);
+  bool matchBefore(const Stream &s, const LRXMatcher::Match &a,
+                   const LRXMatcher::Match &b) const;
+  bool recognisePattern(Stream &s, int32_t translation, int32_t rec) const;
+  int32_t translationId(Stream &s, const char *lu, size_t length) const;
+  int32_t wordClasses(Stream &s, const char *lu, size_t length) const;
+
+  /**
+   * The symbols of the length bytes of UTF-8 at text, as
+   * Alphabet::tokenize gives them for the decoded text, into syms
+   */
+  void tokenize(Stream &s, const char *text, size_t length,
+                vector<int32_t> &syms) const;
+  int32_t tagSymbol(Stream &s, const char *tag, size_t length) const;
+
+  void read_seg(InputFile& input, string& seg) const;
+  void read_seg(LRXInput& input, string& seg) const;
+  void read_seg(LRXRecords& input, string& seg) const;
+
+  /**
+   * Append the rest of a blank to blank in one go where input allows
+   * it, and return the number of newlines appended
+   */
+  size_t read_blank(InputFile& input, string& blank) const;
+  size_t read_blank(LRXInput& input, string& blank) const;
+  size_t read_blank(LRXRecords& input, string& blank) const;
+
+  /**
+   * Take the blank c starts where the input keeps it, without copying
+   * it, where input allows it (see LRXInput::readBlankInPlace)
+   */
+  bool read_blank_ref(InputFile& input, UChar32 c, const char *&text,
+                      size_t &length, size_t &newlines) const;
+  bool read_blank_ref(LRXInput& input, UChar32 c, const char *&text,
+                      size_t &length, size_t &newlines) const;
+  bool read_blank_ref(LRXRecords& input, UChar32 c, const char *&text,
+                      size_t &length, size_t &newlines) const;
 
-  UString itow(int i);
-  bool recognisePattern(const UString& lu, const UString& op);
-  void read_seg(InputFile& input, UString& seg);
-  void make_anys(int32_t sym, std::set<int32_t>& alts);
+  /**
+   * Have input sync output before it waits for more, where input allows
+   * it (see LRXInput::tie)
+   */
+  void tie(InputFile& input, LRXOutput *output) const;
+  void tie(LRXInput& input, LRXOutput *output) const;
+  void tie(LRXRecords& input, LRXOutput *output) const;
 
-  enum OpType { Select, Remove };
+  /**
+   * Process input with the output, which is UTF-8, going to the file
+   * under output, or into output itself if it has none
+   */
+  template<class Input>
+  void processOutput(Stream &s, Input& input, UFILE *output) const;
 
-  void processFlush(UFILE *output,
-                      map<int, UString > &sl,
-                      map<int, vector<UString> > &tl,
-                      map<int, UString > &blanks,
-                      map<int, map<UString, double> > &scores,
-                      map<int, map<UString, OpType> > &operations);
+  /**
+   * Process input, writing to s.output as it was opened
+   */
+  template<class Input>
+  void processStream(Stream &s, Input& input) const;
+
+  /**
+   * Write out the positions of the window from s.emitted up to end
+   */
+  void processFlush(Stream &s, LRXOutput &output, LRXWindow &window,
+                    unsigned int end) const;
+  bool windowFull(const Stream &s, const LRXWindow &window) const;
+  void forceFlush(Stream &s, LRXOutput &output, LRXWindow &window) const;
 
 public:
   static UString const LRX_PROCESSOR_TAG_SELECT;
@@ -84,16 +285,51 @@ public:
   static UString const LRX_PROCESSOR_TAG_WORD_BOUNDARY;
   static UString const LRX_PROCESSOR_TAG_NULL_BOUNDARY;
 
+  static size_t const LRX_PROCESSOR_MAX_TRANSLATIONS;
+
   LRXProcessor();
   ~LRXProcessor();
 
-  void setTraceMode(bool mode);
-  void setDebugMode(bool mode);
-  void setNullFlush(bool mode);
+  void setEngine(LRXMatcher::Engine engine);
+
+  /**
+   * Keep at most max_alive paths of the rules alive, those of the
+   * heaviest rules (see LRXMatcher::setBeam); to be called before load()
+   */
+  void setBeam(size_t max_alive);
+
+  /**
+   * Check the checksum of a binary in the flat format when loading it,
+   * which reads all of it rather than only the pages used
+   */
+  void setVerify(bool value);
+
+  /**
+   * Print what is loaded to standard error; to be called before load()
+   */
+  void setLoadDebug(bool value);
 
   void init();
   void load(FILE *input);
-  void process(InputFile& input, UFILE *output);
+
+  /**
+   * Start s over as a new stream processed with modes, with its trace
+   * and debugging output going to log
+   */
+  void initStream(Stream &s, Modes modes, ostream &log) const;
+
+  /**
+   * Process input as the next part of the stream s; this only reads the
+   * processor, so it is safe to call for different streams at once
+   */
+  void process(Stream &s, InputFile& input, UFILE *output) const;
+  void process(Stream &s, LRXInput& input, UFILE *output) const;
+
+  /**
+   * Process what a reader thread has read into input as the next part of
+   * s, writing to s.output as it was opened (see LRXPipeline)
+   */
+  void process(Stream &s, LRXRecords& input) const;
 };
 
 #endif /* __LRX_PROCESSOR_H__ */
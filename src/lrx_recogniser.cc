@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_recogniser.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <set>
+
+using namespace std;
+
+typedef pair<int32_t, int32_t> KeyState; // (key id, state of its recogniser)
+
+static void
+closure(set<KeyState>& states, vector<Transducer *>& recs, Alphabet const &alphabet)
+{
+  vector<KeyState> todo(states.begin(), states.end());
+  while(!todo.empty())
+  {
+    KeyState cur = todo.back();
+    todo.pop_back();
+    auto& trans = recs[cur.first]->getTransitions();
+    auto it = trans.find(cur.second);
+    if(it == trans.end())
+    {
+      continue;
+    }
+    for(auto& t : it->second)
+    {
+      if(alphabet.decode(t.first).first != 0)
+      {
+        continue;
+      }
+      KeyState next(cur.first, t.second.first);
+      if(states.insert(next).second)
+      {
+        todo.push_back(next);
+      }
+    }
+  }
+}
+
+void
+LRXRecogniser::build(const vector<UString>& names, vector<Transducer *>& recs,
+                     Alphabet const &alphabet)
+{
+  setKeys(names);
+
+  set<KeyState> start;
+  for(size_t i = 0; i < recs.size(); i++)
+  {
+    start.insert(KeyState(i, recs[i]->getInitial()));
+  }
+  closure(start, recs, alphabet);
+
+  map<set<KeyState>, int32_t> seen;
+  vector<set<KeyState>> states;
+  seen[start] = 0;
+  states.push_back(start);
+
+  vector<vector<pair<int32_t, int32_t>>> trans;
+  vector<vector<int32_t>> accepts;
+
+  for(size_t i = 0; i < states.size(); i++)
+  {
+    map<int32_t, set<KeyState>> moves;
+    vector<int32_t> accepted;
+    for(auto& ks : states[i])
+    {
+      Transducer* rec = recs[ks.first];
+      if(rec->getFinals().find(ks.second) != rec->getFinals().end())
+      {
+        accepted.push_back(ks.first);
+      }
+      auto it = rec->getTransitions().find(ks.second);
+      if(it == rec->getTransitions().end())
+      {
+        continue;
+      }
+      for(auto& t : it->second)
+      {
+        int32_t label = alphabet.decode(t.first).first;
+        if(label != 0)
+        {
+          moves[label].insert(KeyState(ks.first, t.second.first));
+        }
+      }
+    }
+    sort(accepted.begin(), accepted.end());
+    accepted.erase(unique(accepted.begin(), accepted.end()), accepted.end());
+
+    vector<pair<int32_t, int32_t>> out;
+    for(auto& mv : moves)
+    {
+      closure(mv.second, recs, alphabet);
+      auto found = seen.find(mv.second);
+      int32_t target;
+      if(found == seen.end())
+      {
+        target = states.size();
+        seen[mv.second] = target;
+        states.push_back(mv.second);
+      }
+      else
+      {
+        target = found->second;
+      }
+      out.push_back(make_pair(mv.first, target));
+    }
+    trans.push_back(out);
+    accepts.push_back(accepted);
+  }
+
+  initial = 0;
+  vector<uint32_t> offsets(1, 0);
+  vector<int32_t> labels;
+  vector<int32_t> targets;
+  vector<uint32_t> final_offsets(1, 0);
+  vector<int32_t> final_keys;
+  for(size_t i = 0; i < trans.size(); i++)
+  {
+    for(auto& t : trans[i])
+    {
+      labels.push_back(t.first);
+      targets.push_back(t.second);
+    }
+    offsets.push_back(labels.size());
+    final_keys.insert(final_keys.end(), accepts[i].begin(), accepts[i].end());
+    final_offsets.push_back(final_keys.size());
+  }
+  this->offsets = std::move(offsets);
+  this->labels = std::move(labels);
+  this->targets = std::move(targets);
+  this->final_offsets = std::move(final_offsets);
+  this->final_keys = std::move(final_keys);
+}
+
+void
+LRXRecogniser::write(LRXFlatWriter &output) const
+{
+  output.array(key_offsets);
+  output.array(key_chars);
+  output.value(initial);
+  output.array(offsets);
+  output.array(labels);
+  output.array(targets);
+  output.array(final_offsets);
+  output.array(final_keys);
+}
+
+void
+LRXRecogniser::read(LRXFlatReader &input)
+{
+  key_offsets = input.array<uint32_t>();
+  key_chars = input.array<UChar>();
+  key_index.clear();
+  indexed = false;
+  initial = input.value();
+  offsets = input.array<uint32_t>();
+  labels = input.array<int32_t>();
+  targets = input.array<int32_t>();
+  final_offsets = input.array<uint32_t>();
+  final_keys = input.array<int32_t>();
+  if(key_offsets.empty() || key_offsets[key_offsets.size() - 1] > key_chars.size() ||
+     offsets.empty() || offsets.size() != final_offsets.size() ||
+     labels.size() != targets.size() || offsets[offsets.size() - 1] != labels.size() ||
+     final_offsets[final_offsets.size() - 1] != final_keys.size())
+  {
+    cerr << "Error: Invalid rules binary (bad recogniser)." << endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+int32_t
+LRXRecogniser::step(int32_t state, int32_t label) const
+{
+  auto begin = labels.begin() + offsets[state];
+  auto end = labels.begin() + offsets[state+1];
+  auto it = lower_bound(begin, end, label);
+  if(it == end || *it != label)
+  {
+    return -1;
+  }
+  return targets[it - labels.begin()];
+}
+
+void
+LRXRecogniser::match(const vector<int32_t>& syms, LRXAlternatives const &alternatives,
+                     vector<int32_t>& result) const
+{
+  result.clear();
+  if(size() == 0)
+  {
+    return;
+  }
+
+  vector<int32_t> cur(1, initial);
+  vector<int32_t> next;
+  for(auto& sym : syms)
+  {
+    if(cur.empty())
+    {
+      return;
+    }
+    int32_t alts[LRXAlternatives::MAX];
+    size_t n = alternatives.get(sym, alts);
+
+    next.clear();
+    for(auto& state : cur)
+    {
+      for(size_t i = 0; i < n; i++)
+      {
+        if(alts[i] == 0)
+        {
+          // State::step leaves nothing alive on a null alternative
+          return;
+        }
+        int32_t target = step(state, alts[i]);
+        if(target >= 0)
+        {
+          next.push_back(target);
+        }
+      }
+    }
+    sort(next.begin(), next.end());
+    next.erase(unique(next.begin(), next.end()), next.end());
+    cur.swap(next);
+  }
+
+  for(auto& state : cur)
+  {
+    result.insert(result.end(), final_keys.begin() + final_offsets[state],
+                  final_keys.begin() + final_offsets[state+1]);
+  }
+  sort(result.begin(), result.end());
+  result.erase(unique(result.begin(), result.end()), result.end());
+}
+
+void
+LRXRecogniser::setKeys(const vector<UString>& keys)
+{
+  vector<uint32_t> offsets(1, 0);
+  UString chars;
+  key_index.clear();
+  for(size_t i = 0; i < keys.size(); i++)
+  {
+    auto& key = keys[i];
+    key_index.insert(make_pair(key, i));
+    chars += key;
+    offsets.push_back(chars.size());
+  }
+  key_offsets = std::move(offsets);
+  key_chars = vector<UChar>(chars.begin(), chars.end());
+  indexed = true;
+}
+
+size_t
+LRXRecogniser::keyCount() const
+{
+  return key_offsets.empty() ? 0 : key_offsets.size() - 1;
+}
+
+UString
+LRXRecogniser::key(int32_t id) const
+{
+  return UString(keyView(id));
+}
+
+UStringView
+LRXRecogniser::keyView(int32_t id) const
+{
+  return UStringView(key_chars.begin() + key_offsets[id], key_offsets[id+1] - key_offsets[id]);
+}
+
+int32_t
+LRXRecogniser::findKey(const UString& key) const
+{
+  if(indexed)
+  {
+    auto it = key_index.find(key);
+    return it == key_index.end() ? -1 : it->second;
+  }
+  size_t low = 0;
+  size_t high = keyCount();
+  while(low < high)
+  {
+    size_t mid = low + (high - low) / 2;
+    int c = key.compare(0, key.size(), key_chars.begin() + key_offsets[mid],
+                        key_offsets[mid+1] - key_offsets[mid]);
+    if(c == 0)
+    {
+      return mid;
+    }
+    else if(c > 0)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  return -1;
+}
+
+size_t
+LRXRecogniser::size() const
+{
+  return offsets.empty() ? 0 : offsets.size() - 1;
+}
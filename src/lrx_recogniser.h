@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_RECOGNISER_H__
+#define __LRX_RECOGNISER_H__
+
+#include <cstdio>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <lttoolbox/alphabet.h>
+#include <lttoolbox/transducer.h>
+
+#include <lrx_alternatives.h>
+#include <lrx_flat.h>
+
+using namespace std;
+
+/**
+ * All the <select>/<remove> recognisers of a rule file as a single
+ * automaton. It is the determinised union of the per-key recognisers
+ * (over their labels, so a symbol still follows its ANY_* alternatives at
+ * runtime), and every final state lists the ids of the keys it accepts,
+ * so a translation is checked against every key in one pass.
+ */
+class LRXRecogniser
+{
+private:
+  // key i is key_chars[key_offsets[i], key_offsets[i+1]); flat binaries
+  // have them in order, and they are searched where they were loaded,
+  // while those in the older format are indexed as they are read
+  LRXFlatArray<uint32_t> key_offsets;
+  LRXFlatArray<UChar> key_chars;
+  unordered_map<UString, int32_t> key_index;
+  bool indexed = false;
+
+  int32_t initial = 0;
+  // transitions of state i are [offsets[i], offsets[i+1]), sorted by label
+  LRXFlatArray<uint32_t> offsets;
+  LRXFlatArray<int32_t> labels;
+  LRXFlatArray<int32_t> targets;
+  // keys accepted in state i are [final_offsets[i], final_offsets[i+1])
+  LRXFlatArray<uint32_t> final_offsets;
+  LRXFlatArray<int32_t> final_keys;
+
+  int32_t step(int32_t state, int32_t label) const;
+  void setKeys(const vector<UString>& keys);
+
+public:
+  /**
+   * Build from one recogniser per key; recs[i] recognises keys[i]
+   */
+  void build(const vector<UString>& names, vector<Transducer *>& recs,
+             Alphabet const &alphabet);
+
+  void write(LRXFlatWriter &output) const;
+  void read(LRXFlatReader &input);
+
+  /**
+   * Ids of all the keys which accept the tokenised translation syms,
+   * in increasing order
+   */
+  void match(const vector<int32_t>& syms, LRXAlternatives const &alternatives,
+             vector<int32_t>& result) const;
+
+  size_t keyCount() const;
+  UString key(int32_t id) const;
+  UStringView keyView(int32_t id) const;
+
+  /**
+   * The id of key, or -1 if it has no recogniser
+   */
+  int32_t findKey(const UString& key) const;
+
+  size_t size() const;
+};
+
+#endif /* __LRX_RECOGNISER_H__ */
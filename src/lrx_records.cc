@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_records.h>
+#include <lrx_output.h>
+
+using namespace std;
+
+size_t const LRXRecords::LRX_RECORDS_RING_SIZE = 1 << 10;
+
+LRXRecords::LRXRecords() :
+ring(LRX_RECORDS_RING_SIZE)
+{
+}
+
+void
+LRXRecords::read(LRXInput &input, bool null_flush, bool bulk)
+{
+  // whether the blank before the next word has any text yet
+  bool in_blank = false;
+  while(true)
+  {
+    Record& r = ring.back();
+    UChar32 val = input.get();
+    if(val == U_EOF)
+    {
+      r.type = Record::End;
+      ring.push();
+      return;
+    }
+    if(null_flush && val == '\0')
+    {
+      r.type = Record::Nul;
+      in_blank = false;
+    }
+    else if(val == '^')
+    {
+      r.type = Record::Word;
+      r.text.clear();
+      r.ends.clear();
+      input.readSegment(r.text);
+      r.ends.push_back(r.text.size());
+      while(input.peek() == '/')
+      {
+        input.get();
+        input.readSegment(r.text);
+        r.ends.push_back(r.text.size());
+      }
+      r.last = input.get();
+      in_blank = false;
+    }
+    else
+    {
+      r.type = Record::Blank;
+      r.first = val;
+      r.at_eof = input.eof();
+      r.text.clear();
+      r.ref = nullptr;
+      r.ref_length = 0;
+      r.newlines = 0;
+      if(!r.at_eof)
+      {
+        if(bulk && (in_blank ||
+                    !input.readBlankInPlace(val, r.ref, r.ref_length, r.newlines)))
+        {
+          r.newlines = input.readBlank(r.text);
+        }
+        in_blank = true;
+      }
+    }
+    ring.push();
+  }
+}
+
+void
+LRXRecords::tie(LRXOutput *output)
+{
+  tied = output;
+}
+
+LRXRecords::Record&
+LRXRecords::next()
+{
+  if(current != nullptr)
+  {
+    ring.pop();
+  }
+  if(tied != nullptr && ring.size() == 0)
+  {
+    tied->sync();
+  }
+  current = &ring.front();
+  segment = 0;
+  done = false;
+  return *current;
+}
+
+bool
+LRXRecords::eof()
+{
+  if(current == nullptr)
+  {
+    return false;
+  }
+  return current->type == Record::End ||
+         (current->type == Record::Blank && current->at_eof);
+}
+
+UChar32
+LRXRecords::get()
+{
+  if(current != nullptr && current->type == Record::End)
+  {
+    return U_EOF;
+  }
+  if(current != nullptr && current->type == Record::Word && !done)
+  {
+    if(segment < current->ends.size())
+    {
+      return '/';
+    }
+    done = true;
+    return current->last;
+  }
+  Record& r = next();
+  switch(r.type)
+  {
+    case Record::Word:
+      return '^';
+    case Record::Blank:
+      return r.first;
+    case Record::Nul:
+      return '\0';
+    default:
+      return U_EOF;
+  }
+}
+
+UChar32
+LRXRecords::peek()
+{
+  if(current != nullptr && current->type == Record::Word && !done)
+  {
+    return segment < current->ends.size() ? '/' : current->last;
+  }
+  return U_EOF;
+}
+
+void
+LRXRecords::readSegment(string &seg)
+{
+  if(current == nullptr || current->type != Record::Word ||
+     segment >= current->ends.size())
+  {
+    return;
+  }
+  size_t start = (segment == 0 ? 0 : current->ends[segment - 1]);
+  seg.append(current->text, start, current->ends[segment] - start);
+  segment++;
+}
+
+size_t
+LRXRecords::readBlank(string &out)
+{
+  if(current == nullptr || current->type != Record::Blank)
+  {
+    return 0;
+  }
+  if(current->ref != nullptr)
+  {
+    // the rest of it, after the first character's byte
+    out.append(current->ref + 1, current->ref_length - 1);
+  }
+  else
+  {
+    out += current->text;
+  }
+  return current->newlines;
+}
+
+bool
+LRXRecords::readBlankInPlace(UChar32 c, const char *&text, size_t &length,
+                             size_t &newlines)
+{
+  if(current == nullptr || current->type != Record::Blank ||
+     current->ref == nullptr)
+  {
+    return false;
+  }
+  text = current->ref;
+  length = current->ref_length;
+  newlines = current->newlines;
+  return true;
+}
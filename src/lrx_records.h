@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_RECORDS_H__
+#define __LRX_RECORDS_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <lttoolbox/ustring.h>
+
+#include <lrx_input.h>
+#include <lrx_ring.h>
+
+using namespace std;
+
+class LRXOutput;
+
+/**
+ * The lexical units, blanks and NULs of an input, read into records by
+ * one thread and replayed to LRXProcessor on another as if it were
+ * reading the input itself: each call the processor makes gives what
+ * the same call on the LRXInput gave the reader, so that the output,
+ * the line numbers and the flushes are those of reading it directly.
+ */
+class LRXRecords
+{
+private:
+  struct Record
+  {
+    enum Type { Word, Blank, Nul, End };
+    Type type = End;
+
+    // Word: the SL form and the TL forms, which end at ends
+    // Blank: the text read after first
+    string text;
+    vector<size_t> ends;
+    UChar32 last = 0; // Word: what was got after the last form
+
+    UChar32 first = 0;       // Blank: the character that started it
+    bool at_eof = false;     // Blank: eof() just after first
+    const char *ref = nullptr; // Blank: all of it, left in the input
+    size_t ref_length = 0;
+    size_t newlines = 0;     // Blank: those after first
+  };
+
+  LRXRing<Record> ring;
+
+  // the record being replayed, if any, and how far
+  Record *current = nullptr;
+  size_t segment = 0;  // the next form of a Word to be read
+  bool done = false;   // what came after a Word has been got
+  LRXOutput *tied = nullptr;
+
+  Record& next();
+
+public:
+  static size_t const LRX_RECORDS_RING_SIZE;
+
+  LRXRecords();
+
+  /**
+   * Read input to its end, as LRXProcessor would with null_flush and,
+   * if bulk, taking each blank whole; for the reading thread
+   */
+  void read(LRXInput &input, bool null_flush, bool bulk);
+
+  // as LRXInput, for the processing thread; output is synced before
+  // a record that has not been read yet is waited on
+  void tie(LRXOutput *output);
+  bool eof();
+  UChar32 get();
+  UChar32 peek();
+  void readSegment(string &seg);
+  size_t readBlank(string &out);
+  bool readBlankInPlace(UChar32 c, const char *&text, size_t &length,
+                        size_t &newlines);
+};
+
+#endif /* __LRX_RECORDS_H__ */
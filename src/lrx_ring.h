@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_RING_H__
+#define __LRX_RING_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/**
+ * A bounded queue between one producer thread and one consumer thread.
+ * The slots are reused: the producer fills the slot back() gives and
+ * push()es it, and the consumer reads the slot front() gives and pop()s
+ * it, so that whatever a slot holds keeps its memory for the next item.
+ * Neither side takes a lock while the other keeps up; one that has to
+ * wait spins for a while before it sleeps until the other wakes it.
+ */
+template<typename T>
+class LRXRing
+{
+private:
+  static size_t const LRX_RING_SPINS = 1 << 10;
+
+  vector<T> slots;
+  size_t mask;
+  alignas(64) atomic<size_t> head{0}; // the next slot to be read
+  alignas(64) atomic<size_t> tail{0}; // the next slot to be filled
+  alignas(64) atomic<unsigned int> sleepers{0};
+  mutex lock;
+  condition_variable changed;
+
+  template<typename F>
+  void wait(F ready)
+  {
+    for(size_t i = 0; i < LRX_RING_SPINS; i++)
+    {
+      if(ready())
+      {
+        return;
+      }
+#if defined(__SSE2__)
+      _mm_pause();
+#endif
+      if(i >= LRX_RING_SPINS / 2)
+      {
+        this_thread::yield();
+      }
+    }
+    unique_lock<mutex> l(lock);
+    sleepers++;
+    changed.wait(l, ready);
+    sleepers--;
+  }
+
+  void wake()
+  {
+    if(sleepers.load() != 0)
+    {
+      lock_guard<mutex> l(lock);
+      changed.notify_all();
+    }
+  }
+
+public:
+  /**
+   * size is rounded up to a power of two
+   */
+  explicit LRXRing(size_t size)
+  {
+    size_t n = 1;
+    while(n < size)
+    {
+      n <<= 1;
+    }
+    slots.resize(n);
+    mask = n - 1;
+  }
+
+  LRXRing(LRXRing const &) = delete;
+  LRXRing & operator=(LRXRing const &) = delete;
+
+  /**
+   * The slot to fill next, once there is one; producer only
+   */
+  T& back()
+  {
+    size_t t = tail.load(memory_order_relaxed);
+    wait([&] { return t - head.load() < slots.size(); });
+    return slots[t & mask];
+  }
+
+  void push()
+  {
+    tail.store(tail.load(memory_order_relaxed) + 1);
+    wake();
+  }
+
+  /**
+   * The slot to read next, once there is one; consumer only
+   */
+  T& front()
+  {
+    size_t h = head.load(memory_order_relaxed);
+    wait([&] { return tail.load() != h; });
+    return slots[h & mask];
+  }
+
+  void pop()
+  {
+    head.store(head.load(memory_order_relaxed) + 1);
+    wake();
+  }
+
+  /**
+   * The number of slots pushed and not yet popped
+   */
+  size_t size() const
+  {
+    return tail.load() - head.load();
+  }
+};
+
+#endif /* __LRX_RING_H__ */
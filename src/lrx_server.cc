@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_server.h>
+#include <lrx_input.h>
+#include <lrx_parallel.h>
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unicode/ustdio.h>
+#include <vector>
+
+using namespace std;
+
+static size_t const LRX_SERVER_BLOCK_SIZE = 1 << 16;
+
+// the socket to remove when the server is stopped
+static char socket_path[sizeof(sockaddr_un::sun_path)];
+
+static void
+stop(int sig)
+{
+  unlink(socket_path);
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+static bool
+address(const char *path, sockaddr_un &addr)
+{
+  if(strlen(path) >= sizeof(addr.sun_path))
+  {
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  return true;
+}
+
+// write all of what is read from one descriptor to the other, as soon as
+// it is read, up to the end; false if it could not be read or written
+static bool
+copy(int from, int to)
+{
+  vector<char> buffer(LRX_SERVER_BLOCK_SIZE);
+  while(true)
+  {
+    ssize_t n = read(from, buffer.data(), buffer.size());
+    if(n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if(n <= 0)
+    {
+      return n == 0;
+    }
+    for(ssize_t done = 0; done < n;)
+    {
+      ssize_t w = write(to, buffer.data() + done, n - done);
+      if(w < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if(w < 0)
+      {
+        return false;
+      }
+      done += w;
+    }
+  }
+}
+
+LRXServer::LRXServer(LRXProcessor const &p, LRXProcessor::Modes const &m,
+                     unsigned int w, bool s, unsigned int t) :
+processor(p),
+modes(m),
+workers(w),
+split_lines(s),
+timeout(t)
+{
+}
+
+void
+LRXServer::run(int connection, LRXProcessor::Stream &s)
+{
+  if(timeout != 0)
+  {
+    // a read that times out fails, which ends the input
+    timeval limit = {static_cast<time_t>(timeout), 0};
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+  }
+
+  // nothing, from -d's counts to the matcher's caches, is carried over
+  // from the session before
+  ostringstream log;
+  processor.initStream(s, modes, log);
+  bool failed = false;
+  int out = dup(connection);
+  FILE *output = out < 0 ? nullptr : fdopen(out, "wb");
+  if(output != nullptr)
+  {
+    if(split_lines)
+    {
+      FILE *input = fdopen(dup(connection), "rb");
+      if(input != nullptr)
+      {
+        failed = !LRXParallel(processor, modes, 1, true).process(input, output, log);
+        fclose(input);
+      }
+    }
+    else
+    {
+      LRXInput input;
+      input.open_fd(connection);
+      UFILE *uoutput = u_finit(output, NULL, NULL);
+      processor.process(s, input, uoutput);
+      u_fclose(uoutput);
+      failed = input.failed();
+    }
+    fclose(output);
+  }
+  else if(out >= 0)
+  {
+    ::close(out);
+  }
+  if(failed)
+  {
+    // closed before the client shut down its end, which -c reports
+    log << "Warning: Ended a session early, as its input could not be read";
+    if(timeout != 0)
+    {
+      log << " (or its client sent nothing for " << timeout << " seconds)";
+    }
+    log << "." << endl;
+  }
+  ::close(connection);
+
+  lock_guard<mutex> l(log_lock);
+  cerr << log.str();
+}
+
+void
+LRXServer::work()
+{
+  LRXProcessor::Stream s;
+  while(true)
+  {
+    int connection;
+    {
+      unique_lock<mutex> l(lock);
+      changed.wait(l, [&] { return !sessions.empty(); });
+      connection = sessions.front();
+      sessions.pop_front();
+    }
+    run(connection, s);
+  }
+}
+
+void
+LRXServer::serve(const char *path)
+{
+  sockaddr_un addr;
+  if(!address(path, addr))
+  {
+    cerr << "Error: Socket path '" << path << "' is too long." << endl;
+    exit(EXIT_FAILURE);
+  }
+  // a client that goes away should end its session, not the server
+  signal(SIGPIPE, SIG_IGN);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listener < 0)
+  {
+    cerr << "Error: Unable to create a socket: " << strerror(errno) << endl;
+    exit(EXIT_FAILURE);
+  }
+  int bound = bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  if(bound != 0 && errno == EADDRINUSE)
+  {
+    // left behind by a server that is gone, unless one still answers
+    struct stat st;
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool alive = connect(probe, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0;
+    ::close(probe);
+    if(alive || stat(path, &st) != 0 || !S_ISSOCK(st.st_mode))
+    {
+      cerr << "Error: '" << path << "' is already in use." << endl;
+      exit(EXIT_FAILURE);
+    }
+    unlink(path);
+    bound = bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  }
+  if(bound != 0 || listen(listener, SOMAXCONN) != 0)
+  {
+    cerr << "Error: Unable to listen at '" << path << "': " << strerror(errno) << endl;
+    exit(EXIT_FAILURE);
+  }
+  strcpy(socket_path, path);
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  for(unsigned int i = 0; i < workers; i++)
+  {
+    thread(&LRXServer::work, this).detach();
+  }
+  while(true)
+  {
+    int connection = accept(listener, nullptr, nullptr);
+    if(connection < 0)
+    {
+      if(errno != EINTR && errno != ECONNABORTED)
+      {
+        cerr << "Warning: Unable to accept a connection: " << strerror(errno) << endl;
+        sleep(1);
+      }
+      continue;
+    }
+    {
+      lock_guard<mutex> l(lock);
+      sessions.push_back(connection);
+    }
+    changed.notify_one();
+  }
+}
+
+bool
+LRXServer::client(const char *path, int input, int output)
+{
+  sockaddr_un addr;
+  if(!address(path, addr))
+  {
+    return false;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(connection < 0 ||
+     connect(connection, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+  {
+    return false;
+  }
+  // the input is sent as it is read, so that with -z each document is
+  // answered while the next is still to come
+  auto sent = make_shared<atomic<bool>>(false);
+  thread([=] {
+    *sent = copy(input, connection);
+    shutdown(connection, SHUT_WR);
+  }).detach();
+  // the connection is left to the exit: if the server closed it early,
+  // the input may still be being read
+  int error = copy(connection, output) ? 0 : errno;
+  if(error != 0)
+  {
+    cerr << "Error: The session with the server at '" << path << "' failed: " << strerror(error) << endl;
+    exit(EXIT_FAILURE);
+  }
+  if(!*sent)
+  {
+    // the server only ends a session early if it failed or timed out
+    cerr << "Error: The server at '" << path << "' ended the session before all of the input was sent." << endl;
+    exit(EXIT_FAILURE);
+  }
+  return true;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_SERVER_H__
+#define __LRX_SERVER_H__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include <lrx_processor.h>
+
+using namespace std;
+
+/**
+ * Serves a loaded processor over a Unix domain socket, each connection
+ * being one stream whose input is what the client writes until it shuts
+ * down its end; the log of -t and -d goes to the server's standard error.
+ */
+class LRXServer
+{
+private:
+  LRXProcessor const &processor;
+  LRXProcessor::Modes modes;
+  unsigned int workers;
+  bool split_lines;
+  unsigned int timeout;
+
+  mutex lock;
+  condition_variable changed;
+  deque<int> sessions; // connections no worker has taken yet
+  mutex log_lock;
+
+  void work();
+  void run(int connection, LRXProcessor::Stream &s);
+
+public:
+  /**
+   * Each session is processed with modes; with split_lines, blank lines
+   * end a window as with -b; with a timeout, a session whose client sends
+   * nothing for that many seconds is ended before its input is
+   */
+  LRXServer(LRXProcessor const &processor, LRXProcessor::Modes const &modes,
+            unsigned int workers, bool split_lines, unsigned int timeout);
+
+  /**
+   * Listen at path, which is removed first if nothing is listening
+   * there any more, and serve until killed; exits on failure
+   */
+  void serve(const char *path);
+
+  /**
+   * Send input to the server at path and write what comes back to
+   * output, as lrx-proc itself would read and write them; returns
+   * false if the server could not be reached, and exits if the session
+   * ends before all of the input was sent
+   */
+  static bool client(const char *path, int input, int output);
+};
+
+#endif /* __LRX_SERVER_H__ */
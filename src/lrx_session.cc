@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_session.h>
+
+#include <cstdlib>
+#include <unicode/ustdio.h>
+
+using namespace std;
+
+LRXModel::LRXModel(FILE *input, LRXMatcher::Engine engine, size_t max_alive)
+{
+  auto p = make_shared<LRXProcessor>();
+  p->setEngine(engine);
+  p->setBeam(max_alive);
+  p->load(input);
+  p->init();
+  processor = p;
+}
+
+LRXModel::LRXModel(shared_ptr<LRXProcessor const> p) :
+processor(p)
+{
+}
+
+LRXProcessor const &
+LRXModel::getProcessor() const
+{
+  return *processor;
+}
+
+LRXSession::LRXSession(LRXModel const &model, ostream &l) :
+processor(model.processor),
+log(&l)
+{
+  processor->initStream(stream, LRXProcessor::Modes(), *log);
+}
+
+void
+LRXSession::setTraceMode(bool m)
+{
+  stream.modes.traceMode = m;
+}
+
+void
+LRXSession::setDebugMode(bool m)
+{
+  stream.modes.debugMode = m;
+}
+
+void
+LRXSession::setNullFlush(bool m)
+{
+  stream.modes.nullFlush = m;
+}
+
+void
+LRXSession::setMaxWindow(size_t tokens, size_t bytes)
+{
+  stream.modes.maxWindowTokens = tokens;
+  stream.modes.maxWindowBytes = bytes;
+}
+
+LRXProcessor::Modes const &
+LRXSession::getModes() const
+{
+  return stream.modes;
+}
+
+unsigned long
+LRXSession::forcedFlushes() const
+{
+  return stream.forced_flushes;
+}
+
+unsigned long
+LRXSession::prunes() const
+{
+  return stream.matcher.prunes();
+}
+
+void
+LRXSession::reset()
+{
+  processor->initStream(stream, stream.modes, *log);
+}
+
+void
+LRXSession::process(InputFile &input, UFILE *output)
+{
+  processor->process(stream, input, output);
+}
+
+void
+LRXSession::process(LRXInput &input, UFILE *output)
+{
+  processor->process(stream, input, output);
+}
+
+string
+LRXSession::process(string const &input)
+{
+  if(input.empty())
+  {
+    return "";
+  }
+  LRXInput in;
+  in.open_in_memory(input.data(), input.size());
+
+  char *buffer = nullptr;
+  size_t size = 0;
+  FILE *mem = open_memstream(&buffer, &size);
+  UFILE *output = u_finit(mem, NULL, NULL);
+  processor->process(stream, in, output);
+  u_fclose(output);
+  fclose(mem);
+  string result(buffer, size);
+  free(buffer);
+  return result;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_SESSION_H__
+#define __LRX_SESSION_H__
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <lttoolbox/input_file.h>
+
+#include <lrx_matcher.h>
+#include <lrx_processor.h>
+
+using namespace std;
+
+/**
+ * A loaded rule file. It is not changed after loading, so one model can
+ * be shared by any number of sessions, in any number of threads; it stays
+ * alive as long as one of them does.
+ */
+class LRXModel
+{
+private:
+  shared_ptr<LRXProcessor const> processor;
+
+  friend class LRXSession;
+
+public:
+  /**
+   * Load the rules compiled by lrx-comp from input, to be run with engine
+   * keeping at most max_alive paths alive, 0 meaning no bound
+   */
+  LRXModel(FILE *input, LRXMatcher::Engine engine = LRXMatcher::NFA, size_t max_alive = 0);
+
+  /**
+   * The rules of processor, which must be loaded and initialised
+   */
+  LRXModel(shared_ptr<LRXProcessor const> processor);
+
+  LRXProcessor const & getProcessor() const;
+};
+
+/**
+ * One stream of input processed with a model: the alive states of the
+ * rules, the line number and the memoised lookups. A session is cheap to
+ * make next to its model, and is used by one thread at a time.
+ */
+class LRXSession
+{
+private:
+  shared_ptr<LRXProcessor const> processor;
+  ostream *log;
+  LRXProcessor::Stream stream;
+
+public:
+  /**
+   * A new session on model, with its trace and debugging output going to
+   * log
+   */
+  LRXSession(LRXModel const &model, ostream &log = cerr);
+
+  void setTraceMode(bool mode);
+  void setDebugMode(bool mode);
+  void setNullFlush(bool mode);
+
+  /**
+   * Bound the window to tokens tokens and bytes bytes of text, 0 meaning
+   * no bound; past either, the words read so far are written out with
+   * the rules that have matched them, and the rules still alive can only
+   * change the words after them
+   */
+  void setMaxWindow(size_t tokens, size_t bytes);
+
+  LRXProcessor::Modes const & getModes() const;
+
+  /**
+   * How many times the window has been flushed for going past its bounds
+   */
+  unsigned long forcedFlushes() const;
+
+  /**
+   * How many steps have gone past the model's bound on alive paths
+   */
+  unsigned long prunes() const;
+
+  /**
+   * Start over as a new stream, keeping the modes
+   */
+  void reset();
+
+  void process(InputFile &input, UFILE *output);
+  void process(LRXInput &input, UFILE *output);
+
+  /**
+   * Process the UTF-8 input as the next part of the stream and return the
+   * output, in UTF-8
+   */
+  string process(string const &input);
+};
+
+#endif /* __LRX_SESSION_H__ */
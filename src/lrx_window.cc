@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lrx_window.h>
+
+#include <algorithm>
+
+#include <unicode/utf8.h>
+
+using namespace std;
+
+void
+LRXWindow::clear()
+{
+  text.clear();
+  tl_spans.clear();
+  token_count = 0;
+}
+
+// where the text of tok starts in the arena, or the end of the arena
+static size_t
+firstByte(const LRXWindow::Token &tok, const vector<LRXWindow::Span> &tl_spans,
+          size_t end)
+{
+  auto in = [&](const LRXWindow::Span &s) {
+    if(s.ref == nullptr && s.length > 0)
+    {
+      end = min(end, s.start);
+    }
+  };
+  in(tok.sl);
+  in(tok.blank);
+  for(size_t i = 0; i < tok.tl_count; i++)
+  {
+    in(tl_spans[tok.tl_first + i]);
+  }
+  return end;
+}
+
+void
+LRXWindow::drop(size_t count)
+{
+  if(count >= token_count)
+  {
+    clear();
+    return;
+  }
+  size_t cut = text.size();
+  size_t tl_cut = tl_spans.size();
+  for(size_t pos = count; pos < token_count; pos++)
+  {
+    cut = firstByte(tokens[pos], tl_spans, cut);
+    if(tokens[pos].tl_count > 0)
+    {
+      tl_cut = min(tl_cut, tokens[pos].tl_first);
+    }
+  }
+  text.erase(0, cut);
+  tl_spans.erase(tl_spans.begin(), tl_spans.begin() + tl_cut);
+  auto move = [&](Span &s) {
+    if(s.ref == nullptr)
+    {
+      s.start = s.length > 0 ? s.start - cut : 0;
+    }
+  };
+  for(auto& tl : tl_spans)
+  {
+    move(tl);
+  }
+  for(size_t pos = count; pos < token_count; pos++)
+  {
+    Token& tok = tokens[pos];
+    move(tok.sl);
+    move(tok.blank);
+    if(tok.tl_count > 0)
+    {
+      tok.tl_first -= tl_cut;
+    }
+  }
+  // the records dropped go to the end, where they are reused
+  rotate(tokens.begin(), tokens.begin() + count, tokens.begin() + token_count);
+  token_count -= count;
+}
+
+size_t
+LRXWindow::dropping(size_t max_bytes) const
+{
+  // the text kept only shrinks as more tokens are dropped
+  size_t count = token_count;
+  size_t first = text.size();
+  while(count > 0)
+  {
+    size_t before = firstByte(tokens[count-1], tl_spans, first);
+    if(text.size() - before > max_bytes)
+    {
+      break;
+    }
+    first = before;
+    count--;
+  }
+  return count;
+}
+
+LRXWindow::Token&
+LRXWindow::at(size_t pos)
+{
+  while(token_count <= pos)
+  {
+    if(token_count == tokens.size())
+    {
+      tokens.emplace_back();
+    }
+    Token& tok = tokens[token_count];
+    tok.sl = Span();
+    tok.blank = Span();
+    tok.tl_first = 0;
+    tok.tl_count = 0;
+    tok.score_count = 0;
+    token_count++;
+  }
+  return tokens[pos];
+}
+
+string&
+LRXWindow::buffer()
+{
+  return text;
+}
+
+size_t
+LRXWindow::mark() const
+{
+  return text.size();
+}
+
+size_t
+LRXWindow::bytes() const
+{
+  return text.size();
+}
+
+LRXWindow::Span
+LRXWindow::spanFrom(size_t start) const
+{
+  Span s;
+  s.start = start;
+  s.length = text.size() - start;
+  return s;
+}
+
+void
+LRXWindow::setSL(size_t pos, Span sl)
+{
+  at(pos).sl = sl;
+}
+
+void
+LRXWindow::addTL(size_t pos, Span tl)
+{
+  Token& tok = at(pos);
+  if(tok.tl_count == 0)
+  {
+    tok.tl_first = tl_spans.size();
+  }
+  tl_spans.push_back(tl);
+  tok.tl_count++;
+}
+
+void
+LRXWindow::appendBlank(size_t pos, UChar32 c)
+{
+  Token& tok = at(pos);
+  if(tok.blank.ref != nullptr)
+  {
+    // the blank goes on after it was taken where it was
+    tok.blank.start = text.size();
+    text.append(tok.blank.ref, tok.blank.length);
+    tok.blank.ref = nullptr;
+  }
+  if(tok.blank.length == 0)
+  {
+    tok.blank.start = text.size();
+  }
+  append(text, c);
+  tok.blank.length = text.size() - tok.blank.start;
+}
+
+void
+LRXWindow::extendBlank(size_t pos)
+{
+  Token& tok = at(pos);
+  tok.blank.length = text.size() - tok.blank.start;
+}
+
+void
+LRXWindow::setBlank(size_t pos, const char* t, size_t length)
+{
+  Token& tok = at(pos);
+  tok.blank.start = 0;
+  tok.blank.length = length;
+  tok.blank.ref = t;
+}
+
+LRXWindow::Span
+LRXWindow::tl(const Token& tok, size_t i) const
+{
+  return tl_spans[tok.tl_first + i];
+}
+
+LRXWindow::Score&
+LRXWindow::score(size_t pos, int32_t key)
+{
+  Token& tok = at(pos);
+  size_t i = 0;
+  for(; i < tok.score_count; i++)
+  {
+    if(tok.scores[i].key == key)
+    {
+      return tok.scores[i];
+    }
+    else if(tok.scores[i].key > key)
+    {
+      break;
+    }
+  }
+  if(tok.score_count == tok.scores.size())
+  {
+    tok.scores.emplace_back();
+  }
+  for(size_t k = tok.score_count; k > i; k--)
+  {
+    tok.scores[k] = tok.scores[k-1];
+  }
+  tok.score_count++;
+  Score& sc = tok.scores[i];
+  sc.key = key;
+  sc.weight = 0.0;
+  sc.op = Select;
+  return sc;
+}
+
+bool
+LRXWindow::empty(Span s) const
+{
+  return s.length == 0;
+}
+
+UChar32
+LRXWindow::first(Span s) const
+{
+  if(s.length == 0)
+  {
+    return 0;
+  }
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(data(s));
+  int32_t i = 0;
+  UChar32 c;
+  U8_NEXT(p, i, static_cast<int32_t>(s.length), c);
+  return c;
+}
+
+const char*
+LRXWindow::data(Span s) const
+{
+  return s.ref != nullptr ? s.ref : text.data() + s.start;
+}
+
+size_t
+LRXWindow::units(Span s) const
+{
+  const char *p = data(s);
+  size_t n = 0;
+  for(size_t i = 0; i < s.length; i++)
+  {
+    uint8_t b = p[i];
+    // a lead byte, and a second unit for what takes four bytes
+    n += (U8_IS_TRAIL(b) ? 0 : 1) + (b >= 0xF0 ? 1 : 0);
+  }
+  return n;
+}
+
+void
+LRXWindow::copy(Span s, UString& out, size_t skip) const
+{
+  decode(data(s), s.length, out, skip);
+}
+
+void
+LRXWindow::write(Span s, LRXOutput& output) const
+{
+  if(s.length > 0)
+  {
+    output.write(data(s), s.length);
+  }
+}
+
+void
+LRXWindow::append(string& text, UChar32 c)
+{
+  if(c < 0)
+  {
+    c = 0xFFFF;
+  }
+  if(c < 0x80)
+  {
+    text += static_cast<char>(c);
+    return;
+  }
+  char bytes[U8_MAX_LENGTH];
+  int32_t n = 0;
+  U8_APPEND_UNSAFE(bytes, n, c);
+  text.append(bytes, n);
+}
+
+void
+LRXWindow::decode(const char* text, size_t length, UString& out, size_t skip)
+{
+  out.clear();
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(text);
+  int32_t n = static_cast<int32_t>(length);
+  int32_t i = 0;
+  U8_FWD_N(p, i, n, skip);
+  while(i < n)
+  {
+    UChar32 c;
+    U8_NEXT(p, i, n, c);
+    out += c;
+  }
+}
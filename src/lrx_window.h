@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2011--2012 Universitat d'Alacant
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LRX_WINDOW_H__
+#define __LRX_WINDOW_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unicode/ustdio.h>
+#include <lttoolbox/ustring.h>
+
+#include <lrx_output.h>
+
+using namespace std;
+
+/**
+ * The lexical units which LRXProcessor holds back until no rule can
+ * match any more. All text (SL forms, TL candidates and blanks) goes
+ * into one arena and the token records are reused across flushes, so
+ * once the buffers have grown to the size of the largest window nothing
+ * is allocated or freed per token. The text is kept as the UTF-8 it was
+ * read as, and is only decoded where a UString is asked for.
+ */
+class LRXWindow
+{
+public:
+  enum OpType { Select, Remove };
+
+  struct Span
+  {
+    size_t start = 0;
+    size_t length = 0;
+    const char *ref = nullptr; // the text, if it is not in the arena
+  };
+
+  struct Score
+  {
+    int32_t key = 0; // op key id
+    double weight = 0.0;
+    OpType op = Select;
+  };
+
+  struct Token
+  {
+    Span sl;
+    Span blank;
+    size_t tl_first = 0;
+    size_t tl_count = 0;
+    // only the first score_count entries are live, the rest are kept
+    // for the next window
+    vector<Score> scores;
+    size_t score_count = 0;
+  };
+
+private:
+  string text; // UTF-8
+  vector<Span> tl_spans;
+  vector<Token> tokens;
+  size_t token_count = 0;
+
+public:
+  /**
+   * Forget every token, keeping the memory for the next window
+   */
+  void clear();
+
+  /**
+   * Forget the first count tokens, and the text only they used; the
+   * others move up to position 0 on
+   */
+  void drop(size_t count);
+
+  /**
+   * How many of the first tokens have to be dropped for the text of the
+   * rest to take at most max_bytes
+   */
+  size_t dropping(size_t max_bytes) const;
+
+  /**
+   * The record for position pos, creating empty records up to it
+   */
+  Token& at(size_t pos);
+
+  /**
+   * The arena that read functions append to; take the result with
+   * spanFrom(mark()) once the text has been appended
+   */
+  string& buffer();
+  size_t mark() const;
+
+  /**
+   * The UTF-8 bytes of the text of the window
+   */
+  size_t bytes() const;
+
+  Span spanFrom(size_t start) const;
+
+  void setSL(size_t pos, Span sl);
+  void addTL(size_t pos, Span tl);
+  void appendBlank(size_t pos, UChar32 c);
+
+  /**
+   * Let the blank of position pos, which must not be empty, take in the
+   * text appended to buffer() since
+   */
+  void extendBlank(size_t pos);
+
+  /**
+   * Let the blank of position pos, which must be empty, be the length
+   * bytes at text, which are not copied and must stay there until the
+   * window is cleared
+   */
+  void setBlank(size_t pos, const char* text, size_t length);
+
+  Span tl(const Token& tok, size_t i) const;
+
+  /**
+   * The score for op key id key at position pos, inserted with weight 0
+   * if it isn't there yet; scores are kept sorted by key
+   */
+  Score& score(size_t pos, int32_t key);
+
+  bool empty(Span s) const;
+  UChar32 first(Span s) const;
+  const char* data(Span s) const;
+
+  /**
+   * The length of s in UTF-16 code units
+   */
+  size_t units(Span s) const;
+
+  /**
+   * Decode s into out, leaving out its first skip characters
+   */
+  void copy(Span s, UString& out, size_t skip = 0) const;
+  void write(Span s, LRXOutput& output) const;
+
+  /**
+   * Append c to text as UTF-8, with a negative c taken as U+FFFF, as
+   * UString does
+   */
+  static void append(string& text, UChar32 c);
+
+  /**
+   * Decode the length bytes of UTF-8 at text into out, leaving out the
+   * first skip characters
+   */
+  static void decode(const char* text, size_t length, UString& out,
+                     size_t skip = 0);
+};
+
+#endif /* __LRX_WINDOW_H__ */